@@ -4,179 +4,307 @@
 #include <limits.h>
 #include <math.h>
 #include "consts.cpp"
+#include "population.cpp"
+#include "distance.cpp"
+#include "simd_cost.cpp"
+#include "mutation_ops.cpp"
+#include "rng.cpp"
+#include "selection.cpp"
+#include "local_search.cpp"
+#include "elite.cpp"
 #pragma once
 
-// Finds the linear distance between 2D coordinates
-float L2distance(float x1, float y1, float x2, float y2) {
-    float x_d = pow(x1 - x2, 2);
-    float y_d = pow(y1 - y2, 2);
-    return sqrt(x_d + y_d);
-}
-
-// Initialization cost table from the (x,y) locations of the cities
-// Could be optimizied since distances are bidirectional, ie cost_table[i][j] = cost_table[j][i] 
-void build_cost_table(float **cost_table){
-  int k, j;
-  for (k = 0; k < NUM_CITIES; k++) {
-      for (j = 0; j < NUM_CITIES; j++) {
-          if (k != j) {
-              cost_table[k][j] = L2distance(city_x[k], city_y[k], city_x[j], city_y[j]);
-          }
-          else {
-              cost_table[k][j] = 0.0;
-          }
-      }
-  }
-};
+// The GA operators below work on the population range [start, end) so the
+// sequential build can call them on the whole population and the parallel
+// build (GA_functions_parallel.cpp) on one thread's slice.
+// They are templated on the gene type (see GeneFor in population.cpp) and on
+// the distance provider (see distance.cpp).
 
 // Function for initializing
 // each member of the population with a random permutation of the cities
-void initialize_population(int **pop){
+template<typename Gene>
+void initialize_population(Gene *pop, uint64_t seed){
   int i, j;
-  for(i = 0; i < POPULATION_SIZE; i++){
+  uint64_t key = rng_key(seed, 0, RNG_INIT);
+  for(i = 0; i < config.population_size; i++){
+    Gene *genes = chromosome(pop, i);
+    Rng rng = rng_member(key, i);
     // Give each gene a default value equal to its position in the array
-    for(j = 0; j<NUM_CITIES; j++){
-      pop[i][j] = j;
+    for(j = 0; j<num_cities; j++){
+      genes[j] = (Gene) j;
     }
 
-    // Randomly shuffle each chromosomes gene positions
+    // Randomly shuffle each chromosomes gene positions (Fisher-Yates)
     // Skip index 0 since the first city is always the same
-    int temp, pos;
-    for(j = 1; j<NUM_CITIES; j++){
-      pos = rand() % NUM_CITIES;
-      temp = pop[i][j];
-      pop[i][j] = pop[i][pos];
-      pop[i][pos] = temp;
+    int pos;
+    Gene temp;
+    for(j = num_cities-1; j > 1; j--){
+      pos = 1 + rng_bounded(&rng, j);
+      temp = genes[j];
+      genes[j] = genes[pos];
+      genes[pos] = temp;
     }
   }
   return;
 }
 
-// Updates the cost of all chromosomes
-void cost_update(int **pop, float *cost, float** cost_table){
-  int i, j;
+// Updates the cost of the chromosomes in [start, end) whose cost_valid flag
+// is clear. Crossover and mutation keep the flag set for the members they
+// produce, so only members created any other way are summed here.
+// (DenseDistance has a batched SIMD version in simd_cost.cpp)
+template<typename Gene, typename Dist>
+void cost_update(Gene *pop, float *cost, uint8_t *cost_valid, const Dist &dist, int start, int end){
+  int i;
 
   // Evaluate every member of the population
-  for(i = 0; i<POPULATION_SIZE; i++){
-    cost[i] = 0.0; // Base cost
-    // Loop through current chromosome and total cost
-    for(j = 1; j<NUM_CITIES; j++){
-      cost[i] += cost_table[pop[i][j-1]][pop[i][j]];
+  for(i = start; i!=end; i++){
+    if(!cost_valid[i]){
+      cost[i] = path_length(dist, chromosome(pop, i));
+      cost_valid[i] = 1;
     }
   }
 }
 
-// Find the fittest member of the population
-float findleastcost(float *cost, float** cost_table){
+// Offer the members of the population in [start, end) to best, the list
+// of the fittest (see elite.cpp)
+void findleastcost(const float *cost, int start, int end, TopK *best){
   int i;
-  float minimum = cost[0];
-  for(i = 1; i<POPULATION_SIZE; i++){
-    if (cost[i] < minimum){
-      minimum = cost[i];
-    }
+  for(i = start; i!=end; i++){
+    topk_offer(best, cost[i], i);
   }
-  return(minimum);
-};
+}
 
-// Perform a series of tournament selections to choose parents for the next
-// generation of solutions
-void selection(float *cost, int *parents){
-  int i, j;
-  int * tournament;
-  int temp_index, best_index;
-  tournament = (int*)calloc(TOURNAMENT_SIZE, sizeof(int));
-  // Select a two parents for every member of the next generation
-  for(i = 0; i < 2*POPULATION_SIZE; i++){
-    // Select TOURNAMENT_SIZE number of the population to compete
-    // in the tournament
-    best_index = rand() % POPULATION_SIZE;
-    for(j = 1; j < TOURNAMENT_SIZE; j++){
-      temp_index = rand() % POPULATION_SIZE;
-      if(cost[temp_index] < cost[best_index]){
-        best_index = temp_index;
-      }
-    }
-    parents[i] = best_index;
+// Crossover bookkeeping. The cities already placed in the child are a
+// bitset (used_words() words of scratch per thread). For each parent a
+// cursor remembers how far its genes have been scanned: the next valid city
+// of a parent at step j is its first unused gene at position >= j, and since
+// cities only ever become used, genes the cursor has passed stay invalid.
+// The fallback "smallest unused city" only moves up for the same reason and
+// skips 64 cities per step with a count-trailing-zeros. Each child therefore
+// costs O(num_cities) instead of rescanning the parents at every gene.
+inline int used_words(){
+  return (num_cities + 63) / 64;
+}
+
+// Words between the bitsets of a block from used_scratch_alloc(), which
+// keeps every thread's bitset on its own cache lines
+inline int used_stride(){
+  return (used_words() + 7) & ~7;
+}
+
+// One used bitset per thread, set up once and passed to the operators;
+// thread t's is at t*used_stride(). NULL when out of memory.
+inline uint64_t* used_scratch_alloc(int threads){
+  return (uint64_t*)aligned_alloc(CACHE_LINE, (size_t)threads*used_stride()*sizeof(uint64_t));
+}
+
+static inline bool city_used(const uint64_t *used, int city){
+  return (used[city >> 6] >> (city & 63)) & 1;
+}
+
+static inline void mark_used(uint64_t *used, int city){
+  used[city >> 6] |= (uint64_t)1 << (city & 63);
+}
+
+// Next valid city of a parent from position j (the greedy choice it offers)
+template<typename Gene>
+static inline int next_from_parent(const Gene *parent, int *cursor, int j, const uint64_t *used){
+  int i = (*cursor > j) ? *cursor : j;
+  while(i < num_cities && city_used(used, parent[i])){
+    i++;
   }
+  *cursor = i;
+  return (i < num_cities) ? parent[i] : -1;
 }
 
-// Subfunction of crossover for next valid index of parents
-int getValidNextCity(int *parent, int *child, int current_index, bool* used_cities){
-  int i, j;
+// Smallest city not in the child yet; *word is where the search resumes
+static inline int lowest_unused(const uint64_t *used, int *word){
+  while(used[*word] == ~(uint64_t)0){
+    (*word)++;
+  }
+  return (*word << 6) + __builtin_ctzll(~used[*word]);
+}
 
-  // Find the next valid city of the parent from the starting index
-  for(i = current_index; i < NUM_CITIES; i++){
-    // Check if city has been used in child yer
-    if(!used_cities[parent[i]]){
-      return(parent[i]);
+// Build one child from two parents, greedily taking whichever parent's next
+// unused city is closer; a parent with no unused genes left from position j
+// offers the smallest unused city instead. used is used_words() of scratch.
+// The edge chosen at every step is already looked up, so the child's cost
+// is summed on the way and returned, and its hash is stored in a non-NULL
+// hash (see tour_hash.cpp).
+template<typename Gene, typename Dist>
+float crossover_child(const Gene *parent1, const Gene *parent2, Gene *child,
+                      const Dist &dist, uint64_t *used, uint64_t *hash){
+  int j;
+  int cursor1 = 1, cursor2 = 1, low_word = 0;
+  child[0] = 0; //First city is always zero
+  memset(used, 0, used_words()*sizeof(uint64_t));
+  mark_used(used, 0);
+  float child_cost = 0.0;
+  uint64_t child_hash = 0;
+  for(j = 1; j < num_cities; j++){
+    int choice1 = next_from_parent(parent1, &cursor1, j, used);
+    int choice2 = next_from_parent(parent2, &cursor2, j, used);
+    if(choice1 < 0 || choice2 < 0){
+      int lowest = lowest_unused(used, &low_word);
+      if(choice1 < 0) choice1 = lowest;
+      if(choice2 < 0) choice2 = lowest;
     }
-  }
-  
-  // If no valid city was found, find sequentially the next valid city in the child
-  for(i = 0; i < NUM_CITIES; i++){
-    if(!used_cities[i]){
-      return(i);
+    float cost1 = dist(child[j-1], choice1);
+    float cost2 = dist(child[j-1], choice2);
+    // Pick the better choice based on cost
+    if(cost1 < cost2){
+      child[j] = (Gene) choice1;
+      mark_used(used, choice1);
+      child_cost += cost1;
+    }else{
+      child[j] = (Gene) choice2;
+      mark_used(used, choice2);
+      child_cost += cost2;
     }
+    if(hash) child_hash ^= edge_key(child[j-1], child[j]);
   }
-  printf("You shouldn't be here! No valid city found in getValidNextCity()");
-  return -1;
+  if(hash) *hash = child_hash;
+  return child_cost;
 }
 
-// Combine parents into children
-void crossover(int** pop, int* parents, float** cost_table){
-  int **new_pop; // The population
-  // Allocate memory for each member of the populations chromosome
-  new_pop = (int**) calloc(POPULATION_SIZE, sizeof(int*));
-  int i, j;
-  for(i = 0; i<POPULATION_SIZE; i++){
-    // Allocate memory for each chromosome's genes
-    new_pop[i] = (int*) calloc(NUM_CITIES, sizeof(int));
-  }
+// Combine parents from pop into children [start, end) of new_pop, storing
+// each child's cost in new_cost as valid and, unless hashes is NULL, its
+// tour hash in hashes. used is the calling thread's used_words() of scratch.
+// Parents are only read from pop and children only written to new_pop, so
+// parallel slices never see another thread's half-written child.
+// The caller swaps the buffers afterwards (arena_swap)
+template<typename Gene, typename Dist>
+void crossover(Gene* pop, Gene* new_pop, int* parents, float *new_cost, uint8_t *new_valid,
+               uint64_t *hashes, const Dist &dist, int start, int end, uint64_t *used){
+  int i;
   // Produce a new child to replace every member of the populations
-  for(i = 0; i < POPULATION_SIZE; i++){
-    new_pop[i][0] = 0; //First city is always zero
-    bool used_cities[NUM_CITIES] = {};
-    used_cities[0] = true;
-    for(j = 1; j < NUM_CITIES; j++){
-      int choice1 = getValidNextCity(pop[parents[i]],new_pop[i],j,used_cities);
-      int choice2 = getValidNextCity(pop[parents[i+POPULATION_SIZE]],new_pop[i],j,used_cities);
-      // Pick the better choice based on cost
-      if(cost_table[new_pop[i][j-1]][choice1] < cost_table[new_pop[i][j-1]][choice2]){
-        new_pop[i][j] = choice1;
-        used_cities[choice1] = true;
-      }else{
-        new_pop[i][j] = choice2;
-        used_cities[choice2] = true;
-      }
-    }
+  for(i = start; i != end; i++){
+    new_cost[i] = crossover_child(chromosome(pop, parents[i]), chromosome(pop, parents[i+config.population_size]),
+                                  chromosome(new_pop, i), dist, used, hashes ? &hashes[i] : NULL);
+    new_valid[i] = 1;
   }
+}
 
-  // Copy New Pop Data
-  for(i=0; i<POPULATION_SIZE; i++){
-    for(j=0; j<NUM_CITIES; j++){
-      pop[i][j] = new_pop[i][j];
+// Apply one config.mutation_operator move to member i.
+// A valid cost gets the move's delta added instead of being invalidated,
+// and a non-NULL hash follows the move.
+template<typename Gene, typename Dist>
+inline void mutate_move(Gene *genes, float *cost, uint8_t *cost_valid, const Dist &dist,
+                        int i, Rng *rng, uint64_t *hash){
+  float delta = random_mutation(dist, genes, config.mutation_operator, rng, hash);
+  if(cost_valid[i]){
+    cost[i] += delta;
+    #ifdef VERIFY_DELTAS
+      verify_delta(dist, genes, cost[i], mutation_operator_name(config.mutation_operator), i);
+    #endif
+  }
+  #ifdef VERIFY_DELTAS
+    if(hash && *hash != tour_hash(genes)){
+      printf("%s hash mismatch on member %d\n", mutation_operator_name(config.mutation_operator), i);
     }
+  #endif
+}
+
+// With config.mutation_chance, apply one move to member i (see mutate_move)
+template<typename Gene, typename Dist>
+inline void mutate_member(Gene *genes, float *cost, uint8_t *cost_valid, const Dist &dist,
+                          int i, Rng *rng, uint64_t *hash){
+  // If a random percent chance occurs
+  if(rng_bounded(rng, 100) <= (uint32_t) config.mutation_chance){
+    mutate_move(genes, cost, cost_valid, dist, i, rng, hash);
+  }
+}
+
+// Mutate random members of the population in [start, end); hashes is
+// NULL or the members' tour hashes
+template<typename Gene, typename Dist>
+void mutation(Gene *pop, float *cost, uint8_t *cost_valid, uint64_t *hashes, const Dist &dist,
+              int start, int end, uint64_t key){
+  int i;
+  for(i = start; i != end; i++){
+    Rng rng = rng_member(key, i);
+    mutate_member(chromosome(pop, i), cost, cost_valid, dist, i, &rng, hashes ? &hashes[i] : NULL);
+  }
+}
+
+// Duplicate elimination (--dedup, PHASED mode), in two passes over the
+// population with a barrier between them. dedup_record enters every
+// member's hash into the shared table; dedup_replace then gives each member
+// that has a cheaper-indexed twin (by hash) one extra mutation move, so the
+// population keeps one copy of every tour. The move carries its cost delta
+// like any mutation, so no member is re-evaluated.
+void dedup_record(TourTable *table, const uint64_t *hashes, int start, int end){
+  int i;
+  for(i = start; i != end; i++){
+    tour_table_insert(table, hashes[i], i);
   }
+}
 
-  // Free Memory
-  for(i = 0; i<POPULATION_SIZE; i++){
-    free(new_pop[i]);
+// Returns how many members of [start, end) were duplicates
+template<typename Gene, typename Dist>
+int dedup_replace(Gene *pop, float *cost, uint8_t *cost_valid, uint64_t *hashes, const TourTable *table,
+                  const Dist &dist, int start, int end, uint64_t key){
+  int i, duplicates = 0;
+  for(i = start; i != end; i++){
+    if(tour_table_find(table, hashes[i]) == i) continue;
+    Rng rng = rng_member(key, i);
+    mutate_move(chromosome(pop, i), cost, cost_valid, dist, i, &rng, &hashes[i]);
+    duplicates++;
   }
-  free(new_pop);
+  return duplicates;
+}
+
+// Build child i of the next buffer from two parents of the current one,
+// mutate it and return its cost
+template<typename Gene, typename Dist>
+inline float fused_child(PopArena<Gene> *arena, const Dist &dist, int i, int parent1, int parent2,
+                         uint64_t *used, Rng *rng){
+  Gene *child = chromosome(arena->next, i);
+  arena->next_cost[i] = crossover_child(chromosome(arena->cur, parent1), chromosome(arena->cur, parent2),
+                                        child, dist, used, NULL);
+  arena->next_valid[i] = 1;
+  mutate_member(child, arena->next_cost, arena->next_valid, dist, i, rng, NULL);
+  return arena->next_cost[i];
 }
 
-// Mutate random members of the population
-void mutation(int **pop){
+// Fused generation (the FUSED mode): produce children [start, end) of
+// the next buffer end to end. Each child's two parent draws, crossover,
+// mutation and cost happen back to back while its parents and the child are
+// still in L1/L2, and the minimum is tracked on the way. Selection reads
+// only the current costs, so no parents[] array and no barriers are needed
+// between the steps. select must be prepared for the current costs.
+// The new children are offered to best, the list of the fittest. used is
+// the calling thread's used_words() of scratch.
+template<typename Gene, typename Dist>
+void generation_fused(PopArena<Gene> *arena, const SelectionTables *select, const Dist &dist,
+                      int start, int end, uint64_t key, TopK *best, uint64_t *used){
   int i;
-  for(i = 0; i < POPULATION_SIZE; i++){
-    // If a random percent chance occurs
-    if((rand() % 100) <= MUTATION_CHANCE){
-      // Select two random indexs and swap
-      int index1 = rand() % NUM_CITIES;
-      int index2 = rand() % NUM_CITIES;
-      int temp = pop[i][index1];
-      pop[i][index1] = pop[i][index2];
-      pop[i][index2] = temp;
+  for(i = start; i != end; i++){
+    Rng rng = rng_member(key, i);
+    int parent1 = select_parent(select, arena->cost, i, &rng);
+    int parent2 = select_parent(select, arena->cost, i + config.population_size, &rng);
+    float child_cost = fused_child(arena, dist, i, parent1, parent2, used, &rng);
+    topk_offer(best, child_cost, i);
+  }
+}
+
+// One generation of the island [start, end) (the ISLANDS mode): like
+// generation_fused, but both parents come from tournaments within the
+// island, so an island never reads another island's members or costs.
+// used is used_words() of scratch. Returns the least cost among the children.
+template<typename Gene, typename Dist>
+float island_generation(PopArena<Gene> *arena, const Dist &dist, int start, int end,
+                        uint64_t key, uint64_t *used){
+  int i;
+  float minimum = INFINITY;
+  for(i = start; i != end; i++){
+    Rng rng = rng_member(key, i);
+    int parent1 = start + tournament(arena->cost + start, end - start, &rng);
+    int parent2 = start + tournament(arena->cost + start, end - start, &rng);
+    float child_cost = fused_child(arena, dist, i, parent1, parent2, used, &rng);
+    if(child_cost < minimum){
+      minimum = child_cost;
     }
   }
-}
\ No newline at end of file
+  return minimum;
+}
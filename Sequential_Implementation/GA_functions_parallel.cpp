@@ -4,232 +4,265 @@
 #include <limits.h>
 #include <math.h>
 #include "consts.cpp"
-#ifdef EMBEDDED
-  #include <pthread.h>
-#endif
+#include "GA_functions.cpp"
+#include "islands.cpp"
+#include "steady_state.cpp"
+#include "transport.cpp"
+#include "tracer.cpp"
+#include "stopping.cpp"
+#include "scheduler.cpp"
+#include <pthread.h>
 #pragma once
 
 // Structure for thread arguments
-typedef struct {
-  int **pop;
-  float *cost;
+template<typename Gene, typename Dist>
+struct TH_args {
+  PopArena<Gene> *arena; // Current and next population buffers and costs
   int *parents;
-  float **cost_table;
+  SelectionTables *select; // Prepared by main once per generation
+  const Dist *dist;
+  const NeighborLists *neighbors; // Local search candidate lists
+  const LsCutoff *ls_cutoff;      // Local search: members to improve
+  LocalSearchScratch *ls_scratch; // Local search: this thread's working memory
+  uint64_t *used;                 // This thread's used bitset for building children (see GA_functions.cpp)
   int start;
   int end;
-  int seed;
-  float *min;
+  uint64_t seed;         // config.seed; streams are keyed by seed, generation and member
+  const int *generation; // Generation being produced
+  TopK *top;             // One per thread: the slice's fittest members (see elite.cpp)
   int thrdIdx;
-} TH_args;
+  Migration<Gene> *migration; // ISLANDS: rings between the islands
+  float *island_min;          // ISLANDS: config.generations x config.threads minimums
+  Transport *transport;       // Migration between processes, NULL when off
+  uint64_t *hashes;           // --dedup: tour hash of each member, NULL when off
+  TourTable *tours;           // --dedup: hashes of the current generation
+  int *duplicates;            // --dedup: duplicates each thread replaced this generation
+  ChunkScheduler *sched;      // Hands out the chunks of the population (see scheduler.cpp)
+  SteadyState *steady;        // STEADY: slot sequence numbers and progress
+};
+
+// Thread entry points: each one runs a GA operator from GA_functions.cpp
+// on part of the population. The population-parallel phases take their
+// members in chunks from the scheduler, starting with the thread's own
+// [start, end) slice and stealing from the other slices once it is done,
+// and stop early once the run is out of time (see stopping.cpp). main runs
+// them with pool_run_chunked(). Every member's random stream is keyed by
+// its index, so chunking and stealing don't change the results.
+// Rank sorting, the table clear and the islands keep static slices; the
+// steady state has no slices at all.
 
-// Finds the linear distance between 2D coordinates
-float L2distance(float x1, float y1, float x2, float y2) {
-    float x_d = pow(x1 - x2, 2);
-    float y_d = pow(y1 - y2, 2);
-    return sqrt(x_d + y_d);
+// Chunks of the whole population for this thread
+template<typename Gene, typename Dist>
+static inline ChunkCursor chunks(const TH_args<Gene, Dist> &args){
+  return chunk_begin(args.sched, args.thrdIdx, 0);
 }
 
-// Initialization cost table from the (x,y) locations of the cities
-// Could be optimizied since distances are bidirectional, ie cost_table[i][j] = cost_table[j][i] 
-void build_cost_table(float **cost_table){
-  int k, j;
-  for (k = 0; k < NUM_CITIES; k++) {
-      for (j = 0; j < NUM_CITIES; j++) {
-          if (k != j) {
-              cost_table[k][j] = L2distance(city_x[k], city_y[k], city_x[j], city_y[j]);
-          }
-          else {
-              cost_table[k][j] = 0.0;
-          }
-      }
+// Chunks of the members that operators produce; the members before
+// config.elites are the elites main carries over (see elite.cpp)
+template<typename Gene, typename Dist>
+static inline ChunkCursor child_chunks(const TH_args<Gene, Dist> &args){
+  return chunk_begin(args.sched, args.thrdIdx, config.elites);
+}
+
+// Updates the cost of all chromosomes and collects the fittest members of
+// the thread's chunks while each chunk's costs are still in cache
+template<typename Gene, typename Dist>
+void* cost_update_slice(void *slice){
+  TH_args<Gene, Dist> args = *( (TH_args<Gene, Dist> *) slice);
+  TopK *best = &args.top[args.thrdIdx];
+  topk_reset(best, elite_count());
+  ChunkCursor c = chunks(args);
+  int lo, hi;
+  while(chunk_next(&c, &lo, &hi)){
+    cost_update(args.arena->cur, args.arena->cost, args.arena->cost_valid, *args.dist, lo, hi);
+    findleastcost(args.arena->cost, lo, hi, best);
   }
+  return NULL;
+}
+
+// Find the fittest members of the thread's chunks, for costs that are already valid
+template<typename Gene, typename Dist>
+void* findleastcost_slice(void *slice){
+  TH_args<Gene, Dist> args = *((TH_args<Gene, Dist> *) slice);
+  TopK *best = &args.top[args.thrdIdx];
+  topk_reset(best, elite_count());
+  ChunkCursor c = chunks(args);
+  int lo, hi;
+  while(chunk_next(&c, &lo, &hi)){
+    findleastcost(args.arena->cost, lo, hi, best);
+  }
+  return NULL;
 };
 
-// Function for initializing
-// each member of the population with a random permutation of the cities
-void initialize_population(int **pop){
-  int i, j;
-  for(i = 0; i < POPULATION_SIZE; i++){
-    // Give each gene a default value equal to its position in the array
-    for(j = 0; j<NUM_CITIES; j++){
-      pop[i][j] = j;
-    }
+// Sort the slice by cost for rank selection; main merges the sorted runs
+template<typename Gene, typename Dist>
+void* rank_sort_slice(void *slice){
+  TH_args<Gene, Dist> args = *((TH_args<Gene, Dist> *) slice);
+  rank_sort(args.select, args.arena->cost, args.start, args.end);
+  return NULL;
+}
 
-    // Randomly shuffle each chromosomes gene positions
-    // Skip index 0 since the first city is always the same
-    int temp, pos;
-    for(j = 1; j<NUM_CITIES; j++){
-      pos = rand() % NUM_CITIES;
-      temp = pop[i][j];
-      pop[i][j] = pop[i][pos];
-      pop[i][pos] = temp;
-    }
+// Choose parents for the next generation of solutions
+template<typename Gene, typename Dist>
+void* selection_slice(void *slice){
+  TH_args<Gene, Dist> args = *( (TH_args<Gene, Dist> *) slice); // 'slice' is a pointer to a structure
+  uint64_t key = rng_key(args.seed, *args.generation, RNG_SELECTION);
+  ChunkCursor c = chunks(args);
+  int lo, hi;
+  while(chunk_next(&c, &lo, &hi)){
+    // Two parents are selected per member of the slice
+    selection(args.select, args.arena->cost, args.parents, lo*2, hi*2, key);
   }
-  return;
+  return NULL;
 }
 
-// Updates the cost of all chromosomes
-void* cost_update(void *slice){
-  TH_args args = *( (TH_args *) slice);
-  int **pop = args.pop;
-  float *cost = args.cost;
-  float** cost_table = args.cost_table;
-  int start = args.start;
-  int end = args.end;
-
-  int i, j;
-
-  // Evaluate every member of the population
-  for(i = start; i!=end; i++){
-    cost[i] = 0.0; // Base cost
-    // Loop through current chromosome and total cost
-    for(j = 1; j<NUM_CITIES; j++){
-      cost[i] += cost_table[pop[i][j-1]][pop[i][j]];
-    }
+// Combine parents into children.
+// main swaps the buffers once every slice is done.
+template<typename Gene, typename Dist>
+void* crossover_slice(void *slice){
+  TH_args<Gene, Dist> args = *((TH_args<Gene, Dist> *) slice);
+  ChunkCursor c = child_chunks(args);
+  int lo, hi;
+  while(chunk_next(&c, &lo, &hi)){
+    crossover(args.arena->cur, args.arena->next, args.parents, args.arena->next_cost, args.arena->next_valid,
+              args.hashes, *args.dist, lo, hi, args.used);
   }
+  return NULL;
 }
 
-// Find the fittest member of the population
-void* findleastcost(void *slice){
-  TH_args args = *((TH_args *) slice);
-  float *cost = args.cost;
-  float** cost_table = args.cost_table;
-  float* min = args.min;
-  int start = args.start;
-  int end = args.end;
-  int thrdIdx = args.thrdIdx;
-
-  int i;
-  float minimum = cost[start];
-  for(i = start; i!= end; i++){
-    if (cost[i] < minimum){
-      minimum = cost[i];
-    }
+// Mutate random members of the population
+template<typename Gene, typename Dist>
+void* mutation_slice(void *slice){
+  TH_args<Gene, Dist> args = *( (TH_args<Gene, Dist> *) slice); // 'slice' is a pointer to a structure
+  uint64_t key = rng_key(args.seed, *args.generation, RNG_MUTATION);
+  ChunkCursor c = child_chunks(args);
+  int lo, hi;
+  while(chunk_next(&c, &lo, &hi)){
+    mutation(args.arena->cur, args.arena->cost, args.arena->cost_valid, args.hashes, *args.dist, lo, hi, key);
   }
+  return NULL;
+}
 
-  min[thrdIdx] = minimum;
-};
-
-// Perform a series of tournament selections to choose parents for the next
-// generation of solutions
-void* selection(void *slice){
-  TH_args args = *( (TH_args *) slice); // 'slice' is a pointer to a structure
-
-  float *cost = args.cost;
-  int *parents = args.parents;
-  int start = args.start;
-  int end = args.end;
-  start *= 2;
-  end *= 2;
-  //printf("Selection thread starts at %d ends at %d", start, end);
-  int i, j;
-  int * tournament;
-  int temp_index, best_index;
-  tournament = (int*)calloc(TOURNAMENT_SIZE, sizeof(int));
-  // Select a two parents for every member of the next generation
-  for(i = start; i != end; i++){
-    // Select TOURNAMENT_SIZE number of the population to compete
-    // in the tournament
-    best_index = rand_r(&args.seed) % POPULATION_SIZE;
-    for(j = 1; j < TOURNAMENT_SIZE; j++){
-      temp_index = rand_r(&args.seed) % POPULATION_SIZE;
-      if(cost[temp_index] < cost[best_index]){
-        best_index = temp_index;
-      }
-    }
-    parents[i] = best_index;
+// Improve the slice's chosen members by local search
+template<typename Gene, typename Dist>
+void* local_search_slice(void *slice){
+  TH_args<Gene, Dist> args = *((TH_args<Gene, Dist> *) slice);
+  ChunkCursor c = chunks(args);
+  int lo, hi;
+  while(chunk_next(&c, &lo, &hi)){
+    local_search_range(args.arena->cur, args.arena->cost, args.arena->cost_valid, args.hashes, *args.dist,
+                       *args.neighbors, lo, hi, *args.ls_cutoff, args.ls_scratch);
   }
+  return NULL;
 }
 
-// Subfunction of crossover for next valid index of parents
-int getValidNextCity(int *parent, int *child, int current_index, bool* used_cities){
-  int i, j;
-
-  // Find the next valid city of the parent from the starting index
-  for(i = current_index; i < NUM_CITIES; i++){
-    // Check if city has been used in child yer
-    if(!used_cities[parent[i]]){
-      return(parent[i]);
-    }
+// Enter the slice's tour hashes into the duplicate table
+template<typename Gene, typename Dist>
+void* dedup_record_slice(void *slice){
+  TH_args<Gene, Dist> args = *((TH_args<Gene, Dist> *) slice);
+  ChunkCursor c = chunks(args);
+  int lo, hi;
+  while(chunk_next(&c, &lo, &hi)){
+    dedup_record(args.tours, args.hashes, lo, hi);
   }
-  
-  // If no valid city was found, find sequentially the next valid city in the child
-  for(i = 0; i < NUM_CITIES; i++){
-    if(!used_cities[i]){
-      return(i);
-    }
-  }
-  printf("You shouldn't be here! No valid city found in getValidNextCity()");
-  return -1;
+  return NULL;
 }
 
-// Combine parents into children
-void* crossover(void *slice){
-  TH_args args = *((TH_args *) slice);
-  int** pop = args.pop;
-  int* parents = args.parents;
-  float** cost_table = args.cost_table;
-  int start = args.start;
-  int end = args.end;
-
-  int **new_pop; // The population
-  // Allocate memory for each member of the populations chromosome
-  new_pop = (int**) calloc(POPULATION_SIZE, sizeof(int*));
-  int i, j;
-  for(i = start; i!=end; i++){
-    // Allocate memory for each chromosome's genes
-    new_pop[i] = (int*) calloc(NUM_CITIES, sizeof(int));
-  }
-  // Produce a new child to replace every member of the populations
-  for(i=start; i!=end; i++){
-    new_pop[i][0] = 0; //First city is always zero
-    bool used_cities[NUM_CITIES] = {};
-    used_cities[0] = true;
-    for(j = 1; j < NUM_CITIES; j++){
-      int choice1 = getValidNextCity(pop[parents[i]],new_pop[i],j,used_cities);
-      int choice2 = getValidNextCity(pop[parents[i+POPULATION_SIZE]],new_pop[i],j,used_cities);
-      // Pick the better choice based on cost
-      if(cost_table[new_pop[i][j-1]][choice1] < cost_table[new_pop[i][j-1]][choice2]){
-        new_pop[i][j] = choice1;
-        used_cities[choice1] = true;
-      }else{
-        new_pop[i][j] = choice2;
-        used_cities[choice2] = true;
-      }
-    }
+// Mutate the slice's duplicates once every hash is in the table
+template<typename Gene, typename Dist>
+void* dedup_replace_slice(void *slice){
+  TH_args<Gene, Dist> args = *((TH_args<Gene, Dist> *) slice);
+  uint64_t key = rng_key(args.seed, *args.generation, RNG_DEDUP);
+  int replaced = 0;
+  ChunkCursor c = chunks(args);
+  int lo, hi;
+  while(chunk_next(&c, &lo, &hi)){
+    replaced += dedup_replace(args.arena->cur, args.arena->cost, args.arena->cost_valid, args.hashes, args.tours,
+                              *args.dist, lo, hi, key);
   }
+  args.duplicates[args.thrdIdx] = replaced;
+  return NULL;
+}
 
-  // Copy New Pop Data
-  for(i=start; i!=end; i++){
-    for(j=0; j<NUM_CITIES; j++){
-      pop[i][j] = new_pop[i][j];
-    }
-  }
+// Empty this thread's share of the duplicate table for the next generation
+template<typename Gene, typename Dist>
+void* dedup_clear_slice(void *slice){
+  TH_args<Gene, Dist> args = *((TH_args<Gene, Dist> *) slice);
+  size_t slots = tour_table_slots(args.tours);
+  tour_table_clear(args.tours, slots*args.thrdIdx/config.threads, slots*(args.thrdIdx + 1)/config.threads);
+  return NULL;
+}
 
-  // Free Memory
-  for(i = start; i!=end; i++){
-    free(new_pop[i]);
+// Produce the thread's chunks of children in one fused pass and collect the fittest.
+// main swaps the buffers once every slice is done.
+template<typename Gene, typename Dist>
+void* generation_fused_slice(void *slice){
+  TH_args<Gene, Dist> args = *( (TH_args<Gene, Dist> *) slice);
+  uint64_t key = rng_key(args.seed, *args.generation, RNG_FUSED);
+  TopK *best = &args.top[args.thrdIdx];
+  topk_reset(best, elite_count());
+  ChunkCursor c = child_chunks(args);
+  int lo, hi;
+  while(chunk_next(&c, &lo, &hi)){
+    generation_fused(args.arena, args.select, *args.dist, lo, hi, key, best, args.used);
   }
-  free(new_pop);
+  return NULL;
 }
 
-// Mutate random members of the population
-void* mutation(void *slice){
-  TH_args args = *( (TH_args *) slice); // 'slice' is a pointer to a structure
-  int **pop = args.pop;
-  int start = args.start;
-  int end = args.end;
-
-  int i;
-  for(i = start; i != end; i++){
-    // If a random percent chance occurs
-    if((rand_r(&args.seed) % 100) <= MUTATION_CHANCE){
-      // Select two random indexs and swap
-      int index1 = rand_r(&args.seed) % NUM_CITIES;
-      int index2 = rand_r(&args.seed) % NUM_CITIES;
-      int temp = pop[i][index1];
-      pop[i][index1] = pop[i][index2];
-      pop[i][index2] = temp;
+// Evolve the slice as an island for all config.generations generations.
+// The island swaps its own view of the arena's buffers, so it never waits
+// for the other islands, and copies its final slice back into the arena's
+// current buffers at the end.
+// Island 0 also exchanges migrants with the other processes of the job.
+template<typename Gene, typename Dist>
+void* island_slice(void *slice){
+  TH_args<Gene, Dist> args = *((TH_args<Gene, Dist> *) slice);
+  PopArena<Gene> view = *args.arena;
+  Transport *transport = (args.thrdIdx == 0) ? args.transport : NULL;
+  void *message = transport ? malloc(transport->max_message) : NULL;
+  int generation;
+  for(generation = 0; generation < config.generations && !stop_requested(); generation++){
+    uint64_t start = trace_now(), t;
+    // Take in migrants as soon as they arrive
+    t = trace_now();
+    island_immigrate(args.migration, args.thrdIdx, &view, args.start, args.end);
+    if(transport){
+      process_immigrate(transport, &view, *args.dist, args.start, args.end, message);
+    }
+    trace_complete("Immigrate", t, generation);
+    float minimum = island_generation(&view, *args.dist, args.start, args.end,
+                                      rng_key(args.seed, generation, RNG_FUSED), args.used);
+    arena_swap(&view);
+    args.island_min[generation*config.threads + args.thrdIdx] = minimum;
+    if(config.target_cost > 0 && minimum <= config.target_cost) stop_now(STOP_TARGET);
+    if((generation + 1) % config.migration_interval == 0 && generation + 1 < config.generations){
+      t = trace_now();
+      island_emigrate(args.migration, args.thrdIdx, &view, args.start, args.end,
+                      (generation + 1) / config.migration_interval);
+      if(transport){
+        process_emigrate(transport, &view, args.start, args.end, (generation + 1) / config.migration_interval, message);
+      }
+      trace_complete("Emigrate", t, generation);
     }
+    trace_complete("Island generation", start, generation);
   }
-}
\ No newline at end of file
+  // Islands can stop after different generations, so each one leaves its
+  // slice in the arena's current buffers
+  if(view.cur != args.arena->cur){
+    memcpy(chromosome(args.arena->cur, args.start), chromosome(view.cur, args.start),
+           (size_t)(args.end - args.start)*num_cities*sizeof(Gene));
+    memcpy(args.arena->cost + args.start, view.cost + args.start, (args.end - args.start)*sizeof(float));
+    memcpy(args.arena->cost_valid + args.start, view.cost_valid + args.start, args.end - args.start);
+  }
+  free(message);
+  return NULL;
+}
+
+// Run the steady state on this thread until the run is over; every thread
+// works on the whole population (see steady_state.cpp)
+template<typename Gene, typename Dist>
+void* steady_slice(void *slice){
+  TH_args<Gene, Dist> args = *((TH_args<Gene, Dist> *) slice);
+  steady_run(args.steady, args.arena, *args.dist, args.thrdIdx, args.seed);
+  return NULL;
+}
@@ -0,0 +1,532 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include "config.cpp"
+#include "thread_pool.cpp"
+
+// Benchmark suite for the GA operators.
+// Every operator is timed on its own over a sweep of population sizes,
+// city counts and thread counts, on random EUC_2D instances (uniform in a
+// 1000 x 1000 square, drawn from config.seed). The parallel operators run
+// through the same thread pool and slice functions as main.cpp; "generation"
+// and "fused_generation" time a whole phased or fused generation.
+//
+// To run on linux:
+// g++ -O2 bench.cpp -o bench -lm -lpthread
+// ./bench [--populations 10000,100000] [--cities 52,200,1000] [--threads 1,2,4]
+//         [--ops crossover,mutation] [--reps 5] [--format json|csv] [--output FILE]
+//         [GA options, see ./GA --help]
+//
+// Each result reports, per operation (a table entry pair for build_distance,
+// a parent for selection, a population member otherwise):
+//   ns_per_op       median over the repetitions; best_ns_per_op is the fastest
+//   bytes_per_op    population, cost and table bytes the operation streams
+//                   (distance lookups of cost evaluations are not counted)
+//   efficiency      T(t0)*t0 / (T(t)*t) against the smallest thread count t0
+//                   of the sweep; 1 for the serial operators
+
+#define MAX_SWEEP 16
+
+enum BenchOp {
+  OP_DISTANCE, OP_INIT, OP_SELECTION, OP_CROSSOVER, OP_MUTATION,
+  OP_COST_UPDATE, OP_MIN_COST, OP_GENERATION, OP_FUSED, NUM_BENCH_OPS
+};
+
+const char* bench_op_name(BenchOp op){
+  switch(op){
+    case OP_DISTANCE: return "build_distance";
+    case OP_INIT: return "initialize_population";
+    case OP_SELECTION: return "selection";
+    case OP_CROSSOVER: return "crossover";
+    case OP_MUTATION: return "mutation";
+    case OP_COST_UPDATE: return "cost_update";
+    case OP_MIN_COST: return "findleastcost";
+    case OP_GENERATION: return "generation";
+    default: return "fused_generation";
+  }
+}
+
+// Operators without a slice function; they run once per size on one thread
+static bool bench_op_serial(BenchOp op){
+  return op == OP_DISTANCE || op == OP_INIT;
+}
+
+typedef struct {
+  int populations[MAX_SWEEP], num_populations;
+  int cities[MAX_SWEEP], num_cities;
+  int threads[MAX_SWEEP], num_threads;
+  bool ops[NUM_BENCH_OPS];
+  int reps;
+  bool csv;
+  const char *output; // NULL writes to stdout
+} BenchConfig;
+
+typedef struct {
+  BenchOp op;
+  int population, cities, threads;
+  int gene_bytes;
+  const char *distance;
+  long ops;              // Operations per repetition
+  double ns_per_op;      // Median of the repetitions
+  double best_ns_per_op;
+  double bytes_per_op;
+  double efficiency;
+} BenchResult;
+
+typedef struct {
+  BenchResult *items;
+  int count, capacity;
+} BenchResults;
+
+static double now_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static void results_push(BenchResults *r, BenchResult result){
+  if(r->count == r->capacity){
+    r->capacity = r->capacity ? 2*r->capacity : 64;
+    r->items = (BenchResult *) realloc(r->items, r->capacity*sizeof(BenchResult));
+    if(r->items == NULL){ perror("(results_push) Can't allocate results"); exit(-1); }
+  }
+  r->items[r->count++] = result;
+}
+
+// The benchmark can't go on without a table it failed to set up
+static void bench_need(bool ok, const char *what){
+  if(!ok){ fprintf(stderr, "(bench) Can't set up %s\n", what); exit(-1); }
+}
+
+// Random EUC_2D instance of the given size
+void bench_instance(TSPInstance *inst, int cities, uint64_t seed){
+  int k;
+  memset(inst, 0, sizeof(TSPInstance));
+  snprintf(inst->name, sizeof(inst->name), "random%d", cities);
+  inst->dimension = cities;
+  inst->type = EUC_2D;
+  inst->format = NO_FORMAT;
+  inst->x = (float *) malloc(cities*sizeof(float));
+  inst->y = (float *) malloc(cities*sizeof(float));
+  Rng rng = rng_member(seed, cities);
+  for(k = 0; k < cities; k++){
+    inst->x[k] = 1000.0f*rng_float(&rng);
+    inst->y[k] = 1000.0f*rng_float(&rng);
+  }
+}
+
+// ---- Bytes a table entry pair of each distance backend stores ----
+
+double distance_pair_bytes(const DenseDistance &){ return 2*sizeof(float); }
+double distance_pair_bytes(const TriangularDistance &){ return sizeof(float); }
+double distance_pair_bytes(const QuantizedDistance &){ return sizeof(uint16_t); }
+double distance_pair_bytes(const CoordDistance &){ return 0; }
+
+// Everything one size of the sweep runs on
+template<typename Gene, typename Dist>
+struct BenchState {
+  const TSPInstance *inst;
+  PopArena<Gene> arena;
+  int *parents;
+  SelectionTables select;
+  Dist dist;
+  TopK *top;
+  uint64_t *used; // One used bitset per thread
+  LsCutoff ls_cutoff;
+  ThreadPool pool;
+  ChunkScheduler sched;
+  Instrument instrument; // Busy times only, for the scheduler's chunk sizes
+  TH_args<Gene, Dist> *args;
+  int generation;
+};
+
+template<typename Gene, typename Dist>
+double bench_bytes(BenchOp op, const BenchState<Gene, Dist> *s){
+  double tour = (double)num_cities*sizeof(Gene);
+  double member = sizeof(float) + sizeof(uint8_t); // A cost and its valid flag
+  double parent = sizeof(int);
+  switch(config.selection){
+    case RANK: parent += sizeof(uint64_t); break;
+    case SUS: parent += sizeof(double); break;
+    case ALIAS: parent += sizeof(AliasEntry); break;
+    default: parent += (double)config.tournament_size*sizeof(float); break;
+  }
+  // Two parent tours in, one child out
+  double crossover = 3*tour + 2*sizeof(int) + member;
+  // A mutated tour is counted whole
+  double mutation = member + config.mutation_chance/100.0*tour;
+  switch(op){
+    case OP_DISTANCE: return distance_pair_bytes(s->dist);
+    case OP_INIT: return tour;
+    case OP_SELECTION: return parent;
+    case OP_CROSSOVER: return crossover;
+    case OP_MUTATION: return mutation;
+    case OP_COST_UPDATE: return tour + member;
+    case OP_MIN_COST: return sizeof(float);
+    case OP_GENERATION: return 2*parent + crossover + mutation + (tour + member) + sizeof(float);
+    default: return 2*parent + crossover + mutation;
+  }
+}
+
+long bench_ops(BenchOp op){
+  switch(op){
+    case OP_DISTANCE: return (long)num_cities*(num_cities - 1)/2;
+    case OP_SELECTION: return 2L*config.population_size;
+    default: return config.population_size;
+  }
+}
+
+// Selection tables for the current costs, as main builds them
+template<typename Gene, typename Dist>
+void bench_select_prepare(BenchState<Gene, Dist> *s){
+  int i;
+  if(s->select.method == RANK){
+    pool_run(&s->pool, rank_sort_slice<Gene, Dist>);
+    for(i=1; i<config.threads; i++){
+      rank_merge(&s->select, s->args[i].start, s->args[i].end);
+    }
+  }
+  selection_prepare(&s->select, s->arena.cost, rng_key(config.seed, s->generation, RNG_SELECTION));
+}
+
+// Untimed setup so every repetition does the same work
+template<typename Gene, typename Dist>
+void bench_setup(BenchOp op, BenchState<Gene, Dist> *s){
+  switch(op){
+    case OP_DISTANCE:
+      free_distance(&s->dist);
+      break;
+    case OP_COST_UPDATE:
+      // Force a full evaluation instead of skipping the valid costs
+      memset(s->arena.cost_valid, 0, config.population_size);
+      break;
+    default:
+      break;
+  }
+}
+
+template<typename Gene, typename Dist>
+void bench_run(BenchOp op, BenchState<Gene, Dist> *s){
+  switch(op){
+    case OP_DISTANCE:
+      bench_need(build_distance(&s->dist, s->inst), "the distance table");
+      break;
+    case OP_INIT:
+      initialize_population(s->arena.cur, config.seed);
+      break;
+    case OP_SELECTION:
+      bench_select_prepare(s);
+      pool_run_chunked(&s->pool, &s->sched, selection_slice<Gene, Dist>, "selection");
+      break;
+    case OP_CROSSOVER:
+      pool_run_chunked(&s->pool, &s->sched, crossover_slice<Gene, Dist>, "crossover");
+      arena_swap(&s->arena);
+      break;
+    case OP_MUTATION:
+      pool_run_chunked(&s->pool, &s->sched, mutation_slice<Gene, Dist>, "mutation");
+      break;
+    case OP_COST_UPDATE:
+      pool_run_chunked(&s->pool, &s->sched, cost_update_slice<Gene, Dist>, "cost update");
+      break;
+    case OP_MIN_COST:
+      pool_run_chunked(&s->pool, &s->sched, findleastcost_slice<Gene, Dist>, "min cost");
+      break;
+    case OP_GENERATION: {
+      bench_select_prepare(s);
+      pool_run_chunked(&s->pool, &s->sched, selection_slice<Gene, Dist>, "selection");
+      pool_run_chunked(&s->pool, &s->sched, crossover_slice<Gene, Dist>, "crossover");
+      arena_swap(&s->arena);
+      pool_run_chunked(&s->pool, &s->sched, mutation_slice<Gene, Dist>, "mutation");
+      // Evaluation collects the fittest; main merges them
+      pool_run_chunked(&s->pool, &s->sched, cost_update_slice<Gene, Dist>, "cost update");
+      TopK best;
+      topk_merge(&best, s->top, config.threads);
+      break;
+    }
+    default:
+      bench_select_prepare(s);
+      pool_run_chunked(&s->pool, &s->sched, generation_fused_slice<Gene, Dist>, "fused");
+      arena_swap(&s->arena);
+      break;
+  }
+}
+
+// Time op over bench->reps repetitions after one warm-up run
+template<typename Gene, typename Dist>
+BenchResult bench_op(BenchOp op, BenchState<Gene, Dist> *s, const BenchConfig *bench){
+  double *times = (double *) malloc(bench->reps*sizeof(double));
+  int rep;
+  for(rep = -1; rep < bench->reps; rep++){
+    bench_setup(op, s);
+    double t0 = now_ns();
+    bench_run(op, s);
+    double t1 = now_ns();
+    if(rep >= 0){
+      times[rep] = t1 - t0;
+    }
+    s->generation++;
+  }
+  std::sort(times, times + bench->reps);
+
+  BenchResult result;
+  result.op = op;
+  result.population = config.population_size;
+  result.cities = num_cities;
+  result.threads = bench_op_serial(op) ? 1 : config.threads;
+  result.gene_bytes = sizeof(Gene);
+  result.distance = distance_backend_name(choose_distance_backend(s->inst));
+  result.ops = bench_ops(op);
+  result.ns_per_op = times[bench->reps/2] / result.ops;
+  result.best_ns_per_op = times[0] / result.ops;
+  result.bytes_per_op = bench_bytes(op, s);
+  result.efficiency = 1.0; // Filled in once the whole sweep is done
+  free(times);
+  fprintf(stderr, "%-22s population %7d cities %6d threads %3d: %10.2f ns/op\n", bench_op_name(op),
+    result.population, result.cities, result.threads, result.ns_per_op);
+  return result;
+}
+
+// Run the population and thread sweeps on one instance
+template<typename Gene, typename Dist>
+void bench_sizes(const TSPInstance *inst, const BenchConfig *bench, BenchResults *results){
+  BenchState<Gene, Dist> s;
+  int p, t, op, i;
+  s.inst = inst;
+  bench_need(build_distance(&s.dist, inst), "the distance table");
+  for(p = 0; p < bench->num_populations; p++){
+    config.population_size = bench->populations[p];
+    bench_need(arena_init(&s.arena), "the population");
+    s.parents = (int *) calloc(config.population_size*2, sizeof(int));
+    bench_need(selection_init(&s.select, config.selection), "the selection tables");
+    for(t = 0; t < bench->num_threads; t++){
+      config.threads = std::min(bench->threads[t], config.population_size);
+      s.top = (TopK *) aligned_alloc(CACHE_LINE, config.threads*sizeof(TopK));
+      s.args = (TH_args<Gene, Dist> *) calloc(config.threads, sizeof(TH_args<Gene, Dist>));
+      s.used = used_scratch_alloc(config.threads);
+      bench_need(s.top != NULL && s.args != NULL && s.used != NULL, "the thread tables");
+      bench_need(scheduler_init(&s.sched, config.threads), "the scheduler");
+      bench_need(instrument_init(&s.instrument, config.threads, false), "the probes");
+      s.generation = 0;
+      int thread_range = (config.population_size + config.threads - 1) / config.threads;
+      for(i = 0; i < config.threads; i++){
+        s.args[i].arena = &s.arena;
+        s.args[i].parents = s.parents;
+        s.args[i].select = &s.select;
+        s.args[i].dist = &s.dist;
+        s.args[i].ls_cutoff = &s.ls_cutoff;
+        s.args[i].used = s.used + (size_t)i*used_stride();
+        s.args[i].start = i * thread_range;
+        s.args[i].end = std::min((i+1) * thread_range, config.population_size);
+        s.args[i].seed = config.seed;
+        s.args[i].generation = &s.generation;
+        s.args[i].top = s.top;
+        s.args[i].thrdIdx = i;
+        s.args[i].sched = &s.sched;
+        scheduler_set_slice(&s.sched, i, s.args[i].start, s.args[i].end);
+      }
+      bench_need(pool_init(&s.pool, config.threads, s.args, sizeof(TH_args<Gene, Dist>), s.instrument.probes), "the worker threads");
+
+      // Start every thread count from the same evaluated population
+      initialize_population(s.arena.cur, config.seed);
+      memset(s.arena.cost_valid, 0, config.population_size);
+      pool_run_chunked(&s.pool, &s.sched, cost_update_slice<Gene, Dist>, "cost update");
+      bench_select_prepare(&s);
+      pool_run_chunked(&s.pool, &s.sched, selection_slice<Gene, Dist>, "selection");
+
+      for(op = 0; op < NUM_BENCH_OPS; op++){
+        if(!bench->ops[op] || (bench_op_serial((BenchOp) op) && t > 0)) continue;
+        results_push(results, bench_op((BenchOp) op, &s, bench));
+      }
+      pool_destroy(&s.pool);
+      free(s.args);
+      free(s.used);
+      scheduler_free(&s.sched);
+      instrument_free(&s.instrument);
+      free(s.top);
+    }
+    selection_free(&s.select);
+    free(s.parents);
+    arena_free(&s.arena);
+  }
+  free_distance(&s.dist);
+}
+
+template<typename Gene>
+void bench_with_distance(const TSPInstance *inst, const BenchConfig *bench, BenchResults *results){
+  switch(choose_distance_backend(inst)){
+    case TRIANGULAR: bench_sizes<Gene, TriangularDistance>(inst, bench, results); break;
+    case QUANTIZED:  bench_sizes<Gene, QuantizedDistance>(inst, bench, results); break;
+    case ON_THE_FLY: bench_sizes<Gene, CoordDistance>(inst, bench, results); break;
+    default:         bench_sizes<Gene, DenseDistance>(inst, bench, results); break;
+  }
+}
+
+// Scaling against the smallest thread count measured for the same sizes
+void bench_efficiency(BenchResults *results){
+  int i, k;
+  for(i = 0; i < results->count; i++){
+    BenchResult *r = &results->items[i];
+    const BenchResult *base = r;
+    for(k = 0; k < results->count; k++){
+      const BenchResult *b = &results->items[k];
+      if(b->op == r->op && b->population == r->population && b->cities == r->cities
+         && b->threads < base->threads){
+        base = b;
+      }
+    }
+    r->efficiency = (base->ns_per_op*base->threads) / (r->ns_per_op*r->threads);
+  }
+}
+
+void write_results(FILE *out, const BenchResults *results, const BenchConfig *bench){
+  int i;
+  if(bench->csv){
+    fprintf(out, "op,population,cities,threads,gene_bytes,distance,ops,ns_per_op,best_ns_per_op,"
+                 "bytes_per_op,efficiency\n");
+    for(i = 0; i < results->count; i++){
+      const BenchResult *r = &results->items[i];
+      fprintf(out, "%s,%d,%d,%d,%d,%s,%ld,%.3f,%.3f,%.1f,%.3f\n", bench_op_name(r->op), r->population,
+        r->cities, r->threads, r->gene_bytes, r->distance, r->ops, r->ns_per_op, r->best_ns_per_op,
+        r->bytes_per_op, r->efficiency);
+    }
+    return;
+  }
+  fprintf(out, "{\n  \"config\": {\"selection\": \"%s\", \"tournament\": %d, \"mutation\": \"%s\", "
+               "\"mutation_chance\": %d, \"seed\": %llu, \"reps\": %d},\n  \"results\": [\n",
+    selection_method_name(config.selection), config.tournament_size,
+    mutation_operator_name(config.mutation_operator), config.mutation_chance,
+    (unsigned long long) config.seed, bench->reps);
+  for(i = 0; i < results->count; i++){
+    const BenchResult *r = &results->items[i];
+    fprintf(out, "    {\"op\": \"%s\", \"population\": %d, \"cities\": %d, \"threads\": %d, "
+                 "\"gene_bytes\": %d, \"distance\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.3f, "
+                 "\"best_ns_per_op\": %.3f, \"bytes_per_op\": %.1f, \"efficiency\": %.3f}%s\n",
+      bench_op_name(r->op), r->population, r->cities, r->threads, r->gene_bytes, r->distance, r->ops,
+      r->ns_per_op, r->best_ns_per_op, r->bytes_per_op, r->efficiency, i + 1 < results->count ? "," : "");
+  }
+  fprintf(out, "  ]\n}\n");
+}
+
+// Comma separated positive integers
+static bool parse_list(const char *text, int *out, int *count){
+  char item[32];
+  *count = 0;
+  while(*text != '\0'){
+    const char *comma = strchr(text, ',');
+    int len = comma ? (int)(comma - text) : (int)strlen(text);
+    if(*count == MAX_SWEEP || len == 0 || len >= (int)sizeof(item)) return false;
+    memcpy(item, text, len);
+    item[len] = '\0';
+    if(!parse_int(item, 1, INT32_MAX, &out[(*count)++])) return false;
+    text += comma ? len + 1 : len;
+  }
+  return *count > 0;
+}
+
+static bool parse_ops(const char *text, bool *ops){
+  char item[32];
+  int op;
+  memset(ops, 0, NUM_BENCH_OPS*sizeof(bool));
+  while(*text != '\0'){
+    const char *comma = strchr(text, ',');
+    int len = comma ? (int)(comma - text) : (int)strlen(text);
+    if(len == 0 || len >= (int)sizeof(item)) return false;
+    memcpy(item, text, len);
+    item[len] = '\0';
+    for(op = 0; op < NUM_BENCH_OPS && strcmp(item, bench_op_name((BenchOp) op)) != 0; op++);
+    if(op == NUM_BENCH_OPS) return false;
+    ops[op] = true;
+    text += comma ? len + 1 : len;
+  }
+  return true;
+}
+
+// Benchmark options; anything else is handed to set_option (config.cpp)
+bool set_bench_option(BenchConfig *bench, const char *key, const char *value){
+  bool ok;
+  if(strcmp(key, "populations") == 0) ok = parse_list(value, bench->populations, &bench->num_populations);
+  else if(strcmp(key, "cities") == 0) ok = parse_list(value, bench->cities, &bench->num_cities);
+  else if(strcmp(key, "threads") == 0) ok = parse_list(value, bench->threads, &bench->num_threads);
+  else if(strcmp(key, "ops") == 0) ok = parse_ops(value, bench->ops);
+  else if(strcmp(key, "reps") == 0) ok = parse_int(value, 1, 1000, &bench->reps);
+  else if(strcmp(key, "format") == 0){
+    bench->csv = (strcmp(value, "csv") == 0);
+    ok = bench->csv || strcmp(value, "json") == 0;
+  }
+  else if(strcmp(key, "output") == 0){ bench->output = value; ok = true; }
+  else return set_option(key, value);
+  if(!ok){
+    printf("Bad value '%s' for option '%s'\n", value, key);
+  }
+  return ok;
+}
+
+int main(int argc, char **argv){
+  BenchConfig bench;
+  int k;
+  memset(&bench, 0, sizeof(bench));
+  bench.populations[0] = 10000; bench.populations[1] = 100000; bench.num_populations = 2;
+  bench.cities[0] = 52; bench.cities[1] = 200; bench.cities[2] = 1000; bench.num_cities = 3;
+  bench.threads[0] = 1; bench.threads[1] = 2; bench.threads[2] = 4; bench.num_threads = 3;
+  for(k = 0; k < NUM_BENCH_OPS; k++) bench.ops[k] = true;
+  bench.reps = 5;
+
+  for(k = 1; k < argc; k++){
+    const char *arg = argv[k];
+    bool missing = (strchr(arg, '=') == NULL && k + 1 >= argc);
+    if(strcmp(arg, "--help") == 0 || strncmp(arg, "--", 2) != 0 || missing){
+      printf("Usage: %s [--populations N,...] [--cities N,...] [--threads N,...] [--ops OP,...]\n"
+             "          [--reps N] [--format json|csv] [--output FILE] [GA options]\n", argv[0]);
+      return strcmp(arg, "--help") == 0 ? 0 : -1;
+    }
+    char key[128];
+    const char *value;
+    const char *equals = strchr(arg, '=');
+    if(equals != NULL){
+      snprintf(key, sizeof(key), "%.*s", (int)(equals - arg - 2), arg + 2);
+      value = equals + 1;
+    }else{
+      snprintf(key, sizeof(key), "%s", arg + 2);
+      value = argv[++k];
+    }
+    if(!set_bench_option(&bench, key, value)){
+      return -1;
+    }
+  }
+  for(k = 0; k < bench.num_cities; k++){
+    if(bench.cities[k] < 8){
+      printf("Instances need at least 8 cities\n");
+      return -1;
+    }
+  }
+  config.verbose = false;
+  config.timing = false;
+  config.report = false;
+
+  BenchResults results = {NULL, 0, 0};
+  for(k = 0; k < bench.num_cities; k++){
+    TSPInstance inst;
+    bench_instance(&inst, bench.cities[k], config.seed);
+    num_cities = inst.dimension;
+    if(num_cities <= 256){
+      bench_with_distance<GeneFor<256>::type>(&inst, &bench, &results);
+    }else if(num_cities <= 65536){
+      bench_with_distance<GeneFor<65536>::type>(&inst, &bench, &results);
+    }else{
+      bench_with_distance<GeneFor<65537>::type>(&inst, &bench, &results);
+    }
+    tsp_free(&inst);
+  }
+  bench_efficiency(&results);
+
+  FILE *out = bench.output ? fopen(bench.output, "w") : stdout;
+  if(out == NULL){ perror(bench.output); return -1; }
+  write_results(out, &results, &bench);
+  if(out != stdout){
+    fclose(out);
+  }
+  free(results.items);
+  return 0;
+}
@@ -0,0 +1,242 @@
+#undef NDEBUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "config.cpp"
+#include "checkpoint.cpp"
+
+// Behavior checks for the operators whose shortcuts a regression would
+// break silently: the O(1) mutation deltas and the hashes that follow
+// them, the crossover's bitset bookkeeping, and the checkpoint file.
+// Every check compares against the slow way (a full path_length, a
+// tour_hash, a fresh population) on random EUC_2D instances, and an
+// assert stops at the first mismatch. The corrupt checkpoints the file
+// check feeds the loader make it print "checksum mismatch" on stderr.
+//
+// To run on linux:
+// g++ -O2 check.cpp -o check -lm -lpthread && ./check
+
+#define CHECK_TOURS 200 // Random tours per instance size
+#define CHECK_MOVES 50  // Moves of each operator per tour
+
+// Random EUC_2D instance of the given size, uniform in a 1000 x 1000 square
+static void check_instance(TSPInstance *inst, int cities, uint64_t seed){
+  int k;
+  memset(inst, 0, sizeof(TSPInstance));
+  snprintf(inst->name, sizeof(inst->name), "check%d", cities);
+  inst->dimension = cities;
+  inst->type = EUC_2D;
+  inst->format = NO_FORMAT;
+  inst->x = (float *) malloc(cities*sizeof(float));
+  inst->y = (float *) malloc(cities*sizeof(float));
+  assert(inst->x != NULL && inst->y != NULL);
+  Rng rng = rng_member(seed, cities);
+  for(k = 0; k < cities; k++){
+    inst->x[k] = 1000.0f*rng_float(&rng);
+    inst->y[k] = 1000.0f*rng_float(&rng);
+  }
+}
+
+// genes visit every city once, starting at city 0
+template<typename Gene>
+static bool is_tour(const Gene *genes){
+  uint64_t used[(65536 + 63) / 64];
+  return migrant_tour_valid(genes, used);
+}
+
+// Random tour starting at city 0
+template<typename Gene>
+static void random_tour(Gene *genes, Rng *rng){
+  int j;
+  for(j = 0; j < num_cities; j++){
+    genes[j] = (Gene) j;
+  }
+  for(j = num_cities - 1; j > 1; j--){
+    int pos = 1 + rng_bounded(rng, j);
+    Gene temp = genes[j];
+    genes[j] = genes[pos];
+    genes[pos] = temp;
+  }
+}
+
+// Every delta a move returns matches a full recompute. The moves come from
+// random_mutation, so the positions are the ones the GA draws, and the
+// tour hash it keeps is checked on the way.
+template<typename Gene, typename Dist>
+static void check_deltas(const Dist &dist, Rng *rng){
+  const MutationOperator ops[] = { SWAP, TWO_OPT, OR_OPT };
+  Gene *genes = (Gene *) malloc(num_cities*sizeof(Gene));
+  int t, m, o;
+  for(t = 0; t < CHECK_TOURS; t++){
+    random_tour(genes, rng);
+    float cost = path_length(dist, genes);
+    uint64_t hash = tour_hash(genes);
+    for(o = 0; o < 3; o++){
+      for(m = 0; m < CHECK_MOVES; m++){
+        cost += random_mutation(dist, genes, ops[o], rng, &hash);
+        assert(is_tour(genes));
+        assert(verify_delta(dist, genes, cost, mutation_operator_name(ops[o]), t));
+        assert(hash == tour_hash(genes));
+        cost = path_length(dist, genes); // Keep the rounding from adding up
+      }
+    }
+  }
+
+  // Every position pair of the first tour, including the adjacent ones and the last position
+  int p, q, len, k;
+  random_tour(genes, rng);
+  for(p = 1; p < num_cities; p++){
+    for(q = p + 1; q < num_cities; q++){
+      float before = path_length(dist, genes);
+      float delta = two_opt_delta(dist, genes, p, q);
+      assert(two_opt_mutation(dist, genes, p, q) == delta);
+      assert(verify_delta(dist, genes, before + delta, "2-opt", p));
+      before = path_length(dist, genes);
+      delta = swap_mutation(dist, genes, p, q);
+      assert(verify_delta(dist, genes, before + delta, "swap", p));
+    }
+  }
+  for(len = 1; len <= 3 && len < num_cities - 1; len++){
+    for(p = 1; p + len <= num_cities; p++){
+      for(k = 0; k < num_cities; k++){
+        if(k >= p - 1 && k <= p + len - 1) continue;
+        float before = path_length(dist, genes);
+        float delta = or_opt_delta(dist, genes, p, len, k);
+        assert(or_opt_mutation(dist, genes, p, len, k) == delta);
+        assert(is_tour(genes));
+        assert(verify_delta(dist, genes, before + delta, "or-opt", p));
+      }
+    }
+  }
+  free(genes);
+}
+
+// Crossover children are tours of the instance, with the cost and hash
+// crossover_child returns for them
+template<typename Gene, typename Dist>
+static void check_crossover(const Dist &dist, Rng *rng){
+  Gene *parent1 = (Gene *) malloc(num_cities*sizeof(Gene));
+  Gene *parent2 = (Gene *) malloc(num_cities*sizeof(Gene));
+  Gene *child = (Gene *) malloc(num_cities*sizeof(Gene));
+  uint64_t *used = used_scratch_alloc(1);
+  int t;
+  for(t = 0; t < CHECK_TOURS; t++){
+    random_tour(parent1, rng);
+    // Identical parents take the path with no choices
+    if(t % 10 == 0) memcpy(parent2, parent1, num_cities*sizeof(Gene));
+    else random_tour(parent2, rng);
+    uint64_t hash;
+    float cost = crossover_child(parent1, parent2, child, dist, used, &hash);
+    assert(is_tour(child));
+    assert(verify_delta(dist, child, cost, "crossover", t));
+    assert(hash == tour_hash(child));
+  }
+  free(parent1);
+  free(parent2);
+  free(child);
+  free(used);
+}
+
+// A checkpoint reads back as the state that was saved, and only for its
+// own instance and an intact file
+template<typename Gene, typename Dist>
+static void check_checkpoint(const Dist &dist, const char *instance){
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/ga-check-%d.ckpt", (int) getpid());
+  PopArena<Gene> arena, restored;
+  EliteArchive<Gene> archive, restored_archive;
+  StopTracker tracker, restored_tracker;
+  TopK best;
+  Checkpointer ck;
+  assert(arena_init(&arena) && arena_init(&restored));
+  assert(archive_init(&archive, elite_count()) && archive_init(&restored_archive, elite_count()));
+  initialize_population(arena.cur, config.seed);
+  cost_update(arena.cur, arena.cost, arena.cost_valid, dist, 0, config.population_size);
+  arena.cost_valid[1] = 0; // An invalid cost round-trips too
+  topk_reset(&best, elite_count());
+  findleastcost(arena.cost, 0, config.population_size, &best);
+  archive.count = 0;
+  archive_update(&archive, arena.cur, &best, 6);
+  stop_tracker_init(&tracker, best.e[0].cost);
+  stop_tracker_update(&tracker, 6, best.e[0].cost - 1);
+  stop_tracker_update(&tracker, 7, best.e[0].cost);
+
+  assert(checkpoint_open<Gene>(&ck, path));
+  assert(checkpoint_save(&ck, &arena, &archive, &tracker, 8, instance));
+  checkpoint_close(&ck); // Waits for the write
+  assert(ck.written == 1);
+
+  uint64_t seed = config.seed;
+  config.seed = seed + 1;
+  assert(checkpoint_load(path, &restored, &restored_archive, &restored_tracker, instance) == 8);
+  assert(config.seed == seed);
+  size_t genes = (size_t)config.population_size*num_cities*sizeof(Gene);
+  assert(memcmp(restored.cur, arena.cur, genes) == 0);
+  assert(memcmp(restored.cost, arena.cost, config.population_size*sizeof(float)) == 0);
+  assert(memcmp(restored.cost_valid, arena.cost_valid, config.population_size) == 0);
+  assert(restored_archive.count == archive.count);
+  assert(memcmp(restored_archive.genes, archive.genes, (size_t)archive.count*num_cities*sizeof(Gene)) == 0);
+  assert(memcmp(restored_archive.cost, archive.cost, archive.count*sizeof(float)) == 0);
+  assert(memcmp(restored_archive.hash, archive.hash, archive.count*sizeof(uint64_t)) == 0);
+  assert(memcmp(restored_archive.generation, archive.generation, archive.count*sizeof(int)) == 0);
+  assert(restored_tracker.best_cost == tracker.best_cost);
+  assert(restored_tracker.best_generation == 6 && restored_tracker.stagnant == 1);
+
+  assert(checkpoint_load(path, &restored, &restored_archive, &restored_tracker, "another") == CHECKPOINT_OTHER);
+  // Flip a byte of the header and then one of the population
+  size_t offsets[2] = { offsetof(CheckpointHeader, stop_stagnant), CHECKPOINT_PAGE + 1 };
+  for(int f = 0; f < 2; f++){
+    FILE *file = fopen(path, "r+b");
+    assert(file != NULL);
+    fseek(file, (long) offsets[f], SEEK_SET);
+    int byte = fgetc(file);
+    fseek(file, (long) offsets[f], SEEK_SET);
+    fputc(byte ^ 0x40, file);
+    fclose(file);
+    assert(checkpoint_load(path, &restored, &restored_archive, &restored_tracker, instance) == CHECKPOINT_ERROR);
+    file = fopen(path, "r+b");
+    fseek(file, (long) offsets[f], SEEK_SET);
+    fputc(byte, file);
+    fclose(file);
+  }
+  unlink(path);
+  arena_free(&arena);
+  arena_free(&restored);
+  archive_free(&archive);
+  archive_free(&restored_archive);
+}
+
+template<typename Gene, typename Dist>
+static void check_backend(const TSPInstance *inst, const char *name, uint64_t seed){
+  Dist dist;
+  assert(build_distance(&dist, inst));
+  Rng rng = rng_member(seed, inst->dimension);
+  check_deltas<Gene>(dist, &rng);
+  check_crossover<Gene>(dist, &rng);
+  check_checkpoint<Gene>(dist, inst->name);
+  free_distance(&dist);
+  printf("%-10s %5d cities: deltas, crossover and checkpoint ok\n", name, inst->dimension);
+}
+
+template<typename Gene>
+static void check_size(int cities){
+  TSPInstance inst;
+  check_instance(&inst, cities, config.seed);
+  num_cities = cities;
+  check_backend<Gene, DenseDistance>(&inst, "dense", config.seed);
+  check_backend<Gene, TriangularDistance>(&inst, "triangular", config.seed);
+  check_backend<Gene, CoordDistance>(&inst, "on-the-fly", config.seed);
+  tsp_free(&inst);
+}
+
+int main(){
+  config.population_size = 64;
+  config.elites = 4;
+  check_size<GeneFor<256>::type>(5);
+  check_size<GeneFor<256>::type>(52);
+  check_size<GeneFor<65536>::type>(300);
+  printf("All checks passed\n");
+  return 0;
+}
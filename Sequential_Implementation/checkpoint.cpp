@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "consts.cpp"
+#include "population.cpp"
+#include "elite.cpp"
+#include "stopping.cpp"
+#include "tracer.cpp"
+#pragma once
+
+// Checkpoint/restart (--checkpoint FILE, --resume FILE).
+// A checkpoint holds everything a single-process PHASED or FUSED run
+// needs to continue bit-for-bit: the current population, its costs and
+// valid flags, the next generation and the seed, the elite archive with
+// the generation of each tour, and the stopping policies' best cost and
+// stagnation count. The random streams are keyed by
+// (seed, generation, phase, member) (see rng.cpp), so the seed and the
+// generation are the whole RNG state; a resumed run prints the same
+// generations, best tour and best generation as one that was never
+// stopped. Only the time budget starts over, from the resume.
+//
+// File layout (version 2), all sections at fixed offsets recorded in the
+// header so the file can be mmap'd and read in place:
+//   [0, 4096)        CheckpointHeader, with the archive's costs, hashes and
+//                    generations and the StopTracker
+//   genes_offset     population_size x num_cities genes, page aligned
+//   cost_offset      population_size floats
+//   valid_offset     population_size bytes
+//   archive_offset   archive_k x num_cities genes, the archive's tours
+//                    cheapest first (archive_count of them are used)
+//
+// Writing does not stall the generation loop: main copies the state into a
+// snapshot buffer laid out like the file (a few memcpys) and hands it to a
+// writer thread, which checksums it, writes FILE.tmp, fsyncs it and renames
+// it over FILE, so FILE is always a complete checkpoint. If the writer is
+// still busy with the previous checkpoint, the new one is skipped.
+
+#define CHECKPOINT_MAGIC "GACKPT\0"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_PAGE 4096
+
+// checkpoint_load results besides a generation
+#define CHECKPOINT_ERROR -1 // Unreadable, corrupt or from a different setup
+#define CHECKPOINT_OTHER -2 // A checkpoint of another instance
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t gene_bytes;
+  int32_t num_cities;
+  int32_t population_size;
+  int32_t generation;       // Next generation to produce
+  uint64_t seed;
+  char instance[64];
+  int32_t archive_k, archive_count; // The EliteArchive (see elite.cpp)
+  float archive_cost[MAX_ELITES];
+  uint64_t archive_hash[MAX_ELITES];
+  int32_t archive_generation[MAX_ELITES];
+  float stop_best_cost;     // The StopTracker (see stopping.cpp)
+  int32_t stop_best_generation;
+  int32_t stop_stagnant;
+  uint64_t genes_offset, cost_offset, valid_offset, archive_offset;
+  uint64_t file_bytes;
+  uint64_t checksum;        // FNV-1a of the header up to here and everything past the header page
+} CheckpointHeader;
+
+static_assert(sizeof(CheckpointHeader) <= CHECKPOINT_PAGE, "the header fills the first page");
+
+typedef struct {
+  const char *path;
+  char *tmp_path;
+  CheckpointHeader *buffer; // Snapshot laid out like the file
+  size_t bytes;
+  pthread_t writer;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  bool busy;                // The writer owns the buffer
+  bool shutdown;
+  int written, skipped;
+} Checkpointer;
+
+static size_t align_up(size_t bytes, size_t align){
+  return (bytes + align - 1) & ~(align - 1);
+}
+
+// Section offsets for the current config.population_size and num_cities
+// and an archive of archive_k tours
+static void checkpoint_layout(CheckpointHeader *h, size_t gene_bytes, int archive_k){
+  size_t genes = (size_t)config.population_size*num_cities*gene_bytes;
+  h->genes_offset = CHECKPOINT_PAGE;
+  h->cost_offset = align_up(h->genes_offset + genes, CACHE_LINE);
+  h->valid_offset = align_up(h->cost_offset + config.population_size*sizeof(float), CACHE_LINE);
+  h->archive_offset = align_up(h->valid_offset + config.population_size, CACHE_LINE);
+  h->file_bytes = h->archive_offset + (size_t)archive_k*num_cities*gene_bytes;
+}
+
+static uint64_t fnv1a(const uint8_t *data, size_t bytes, uint64_t hash){
+  size_t k;
+  for(k = 0; k < bytes; k++){
+    hash = (hash ^ data[k]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Checksum of a checkpoint laid out in memory; the header's padding is
+// zeroed with the rest of the snapshot buffer, so it hashes the same
+static uint64_t checkpoint_checksum(const CheckpointHeader *h){
+  const uint8_t *base = (const uint8_t *) h;
+  uint64_t hash = fnv1a(base, offsetof(CheckpointHeader, checksum), 0xcbf29ce484222325ull);
+  return fnv1a(base + CHECKPOINT_PAGE, h->file_bytes - CHECKPOINT_PAGE, hash);
+}
+
+static bool write_all(int fd, const uint8_t *data, size_t bytes){
+  while(bytes > 0){
+    ssize_t n = write(fd, data, bytes);
+    if(n < 0) return false;
+    data += n;
+    bytes -= n;
+  }
+  return true;
+}
+
+static void* checkpoint_writer_main(void *arg){
+  Checkpointer *ck = (Checkpointer *) arg;
+  trace_thread("checkpoint", -1);
+  pthread_mutex_lock(&ck->lock);
+  while(true){
+    while(!ck->busy && !ck->shutdown){
+      pthread_cond_wait(&ck->wake, &ck->lock);
+    }
+    if(!ck->busy) break; // Shut down with nothing left to write
+    pthread_mutex_unlock(&ck->lock);
+
+    uint64_t t = trace_now();
+    CheckpointHeader *h = ck->buffer;
+    h->checksum = checkpoint_checksum(h);
+    int fd = open(ck->tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0 && write_all(fd, (const uint8_t *) h, h->file_bytes) && fsync(fd) == 0;
+    if(fd >= 0) close(fd);
+    if(ok && rename(ck->tmp_path, ck->path) != 0) ok = false;
+    if(!ok) perror("(checkpoint) Can't write checkpoint");
+    trace_complete("Checkpoint write", t, h->generation);
+
+    pthread_mutex_lock(&ck->lock);
+    ck->busy = false;
+    if(ok) ck->written++;
+  }
+  pthread_mutex_unlock(&ck->lock);
+  return NULL;
+}
+
+// Start the writer for checkpoints of Gene populations into path. False
+// when the buffer or the writer thread can't be had; nothing is left open.
+template<typename Gene>
+bool checkpoint_open(Checkpointer *ck, const char *path){
+  CheckpointHeader layout;
+  checkpoint_layout(&layout, sizeof(Gene), elite_count());
+  ck->path = path;
+  ck->tmp_path = (char *) malloc(strlen(path) + 5);
+  ck->bytes = align_up(layout.file_bytes, CHECKPOINT_PAGE);
+  ck->buffer = (CheckpointHeader *) aligned_alloc(CHECKPOINT_PAGE, ck->bytes);
+  if(ck->tmp_path == NULL || ck->buffer == NULL){
+    free(ck->tmp_path);
+    free(ck->buffer);
+    return false;
+  }
+  sprintf(ck->tmp_path, "%s.tmp", path);
+  memset(ck->buffer, 0, ck->bytes);
+  ck->busy = false;
+  ck->shutdown = false;
+  ck->written = ck->skipped = 0;
+  pthread_mutex_init(&ck->lock, NULL);
+  pthread_cond_init(&ck->wake, NULL);
+  int status = pthread_create(&ck->writer, NULL, checkpoint_writer_main, (void *) ck);
+  if(status != 0){
+    pthread_mutex_destroy(&ck->lock);
+    pthread_cond_destroy(&ck->wake);
+    free(ck->tmp_path);
+    free(ck->buffer);
+    return false;
+  }
+  return true;
+}
+
+// Finish the last write and stop the writer
+void checkpoint_close(Checkpointer *ck){
+  pthread_mutex_lock(&ck->lock);
+  ck->shutdown = true;
+  pthread_cond_signal(&ck->wake);
+  pthread_mutex_unlock(&ck->lock);
+  pthread_join(ck->writer, NULL);
+  pthread_mutex_destroy(&ck->lock);
+  pthread_cond_destroy(&ck->wake);
+  free(ck->buffer);
+  free(ck->tmp_path);
+}
+
+// Copy the state before generation `generation` into the snapshot buffer
+// and hand it to the writer; archive and tracker have accounted for the
+// generations before it. Returns false (and skips it) while the previous
+// checkpoint is still being written.
+template<typename Gene>
+bool checkpoint_save(Checkpointer *ck, const PopArena<Gene> *arena, const EliteArchive<Gene> *archive,
+                     const StopTracker *tracker, int generation, const char *instance){
+  pthread_mutex_lock(&ck->lock);
+  bool busy = ck->busy;
+  if(busy) ck->skipped++;
+  pthread_mutex_unlock(&ck->lock);
+  if(busy) return false;
+
+  CheckpointHeader *h = ck->buffer;
+  uint8_t *base = (uint8_t *) h;
+  memcpy(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic));
+  h->version = CHECKPOINT_VERSION;
+  h->gene_bytes = sizeof(Gene);
+  h->num_cities = num_cities;
+  h->population_size = config.population_size;
+  h->generation = generation;
+  h->seed = config.seed;
+  snprintf(h->instance, sizeof(h->instance), "%s", instance);
+  h->archive_k = archive->k;
+  h->archive_count = archive->count;
+  memcpy(h->archive_cost, archive->cost, archive->count*sizeof(float));
+  memcpy(h->archive_hash, archive->hash, archive->count*sizeof(uint64_t));
+  memcpy(h->archive_generation, archive->generation, archive->count*sizeof(int32_t));
+  h->stop_best_cost = tracker->best_cost;
+  h->stop_best_generation = tracker->best_generation;
+  h->stop_stagnant = tracker->stagnant;
+  checkpoint_layout(h, sizeof(Gene), archive->k);
+  memcpy(base + h->genes_offset, arena->cur, (size_t)config.population_size*num_cities*sizeof(Gene));
+  memcpy(base + h->cost_offset, arena->cost, config.population_size*sizeof(float));
+  memcpy(base + h->valid_offset, arena->cost_valid, config.population_size);
+  memcpy(base + h->archive_offset, archive->genes, (size_t)archive->count*num_cities*sizeof(Gene));
+
+  pthread_mutex_lock(&ck->lock);
+  ck->busy = true;
+  pthread_cond_signal(&ck->wake);
+  pthread_mutex_unlock(&ck->lock);
+  return true;
+}
+
+// Restore a checkpoint of instance into arena, archive and tracker. Returns
+// the generation to continue from, CHECKPOINT_OTHER when path holds another
+// instance, or CHECKPOINT_ERROR (after printing why) when it can't be used
+// for this run. Sets config.seed to the checkpoint's seed. An archive that
+// keeps fewer tours than the checkpoint's takes the best of them.
+template<typename Gene>
+int checkpoint_load(const char *path, PopArena<Gene> *arena, EliteArchive<Gene> *archive, StopTracker *tracker,
+                    const char *instance){
+  int fd = open(path, O_RDONLY);
+  if(fd < 0){ perror(path); return CHECKPOINT_ERROR; }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t) st.st_size < CHECKPOINT_PAGE){
+    fprintf(stderr, "%s: not a checkpoint\n", path);
+    close(fd);
+    return CHECKPOINT_ERROR;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED){ perror(path); return CHECKPOINT_ERROR; }
+  const CheckpointHeader *h = (const CheckpointHeader *) map;
+  const uint8_t *base = (const uint8_t *) map;
+  CheckpointHeader layout; // Only compared once archive_k is known to be sane
+  checkpoint_layout(&layout, sizeof(Gene), h->archive_k);
+
+  const char *error = NULL;
+  if(memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic)) != 0) error = "not a checkpoint";
+  else if(h->version != CHECKPOINT_VERSION) error = "unsupported checkpoint version";
+  else if(strncmp(h->instance, instance, sizeof(h->instance)) != 0){
+    munmap(map, st.st_size);
+    return CHECKPOINT_OTHER;
+  }
+  else if(h->num_cities != num_cities || h->gene_bytes != sizeof(Gene)) error = "city count does not match";
+  else if(h->population_size != config.population_size) error = "population size does not match";
+  else if(h->archive_k < 1 || h->archive_k > MAX_ELITES || h->archive_count < 1 || h->archive_count > h->archive_k){
+    error = "bad elite archive";
+  }
+  else if(h->genes_offset != layout.genes_offset || h->cost_offset != layout.cost_offset
+          || h->valid_offset != layout.valid_offset || h->archive_offset != layout.archive_offset
+          || h->file_bytes != layout.file_bytes || h->file_bytes > (uint64_t) st.st_size) error = "bad layout";
+  else if(checkpoint_checksum(h) != h->checksum) error = "checksum mismatch";
+  if(error != NULL){
+    fprintf(stderr, "%s: %s\n", path, error);
+    munmap(map, st.st_size);
+    return CHECKPOINT_ERROR;
+  }
+
+  memcpy(arena->cur, base + h->genes_offset, (size_t)config.population_size*num_cities*sizeof(Gene));
+  memcpy(arena->cost, base + h->cost_offset, config.population_size*sizeof(float));
+  memcpy(arena->cost_valid, base + h->valid_offset, config.population_size);
+  archive->count = h->archive_count < archive->k ? h->archive_count : archive->k;
+  memcpy(archive->genes, base + h->archive_offset, (size_t)archive->count*num_cities*sizeof(Gene));
+  memcpy(archive->cost, h->archive_cost, archive->count*sizeof(float));
+  memcpy(archive->hash, h->archive_hash, archive->count*sizeof(uint64_t));
+  memcpy(archive->generation, h->archive_generation, archive->count*sizeof(int32_t));
+  tracker->best_cost = h->stop_best_cost;
+  tracker->best_generation = h->stop_best_generation;
+  tracker->stagnant = h->stop_stagnant;
+  config.seed = h->seed;
+  int generation = h->generation;
+  munmap(map, st.st_size);
+  return generation;
+}
@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "consts.cpp"
+#include "GA_functions_parallel.cpp"
+#pragma once
+
+// Run-time configuration. Every field of GAConfig (consts.cpp) can be set
+// on the command line as --key value (or --key=value), or in a config file
+// of "key = value" lines loaded with --config FILE; '#' starts a comment.
+// Later settings override earlier ones, so flags after --config win.
+// Arguments that are not options are TSPLIB instances to solve.
+
+const char* generation_mode_name(GenerationMode mode){
+  switch(mode){
+    case FUSED: return "fused";
+    case ISLANDS: return "islands";
+    case STEADY: return "steady";
+    default: return "phased";
+  }
+}
+
+const char* local_search_scope_name(LocalSearchScope scope){
+  switch(scope){
+    case ELITE_MEMBERS: return "elite";
+    case ALL_MEMBERS: return "all";
+    default: return "off";
+  }
+}
+
+void print_usage(const char *program){
+  printf("Usage: %s [options] [instance.tsp ...]   (defaults to instances/berlin52.tsp)\n", program);
+  printf("  --population N         members per generation (%d)\n", config.population_size);
+  printf("  --generations N        generations to run, 0 for no limit (%d)\n", config.generations);
+  printf("  --time-limit S         stop after S seconds of wall time, mid-generation if need be\n");
+  printf("  --target C             stop once the best cost is at most C\n");
+  printf("  --stagnation N         stop after N generations without a better best cost\n");
+  printf("  --min-diversity D      stop once the costs' standard deviation / mean is below D\n");
+  printf("  --threads N            worker threads, 1 runs on the main thread (%d)\n", config.threads);
+  printf("  --chunk N              members per work-stealing chunk, 0 to tune per phase, at most %d,\n"
+         "                         rounded up to a multiple of %d (%d)\n", MAX_CHUNK, CHUNK_ALIGN, config.chunk);
+  printf("  --mode M               phased, fused, islands or steady (%s)\n", generation_mode_name(config.mode));
+  printf("  --selection S          tournament, rank, sus or alias (%s)\n", selection_method_name(config.selection));
+  printf("  --tournament N         tournament size (%d)\n", config.tournament_size);
+  printf("  --mutation-chance N    %% chance to mutate a member (%d)\n", config.mutation_chance);
+  printf("  --mutation OP          swap, 2-opt or or-opt (%s)\n", mutation_operator_name(config.mutation_operator));
+  printf("  --local-search S       off, elite or all (%s)\n", local_search_scope_name(config.local_search));
+  printf("  --ls-elite N           %% of the population improved by elite local search (%d)\n", config.local_search_elite);
+  printf("  --neighbors K          candidate cities per city for local search (%d)\n", config.neighbor_k);
+  printf("  --dedup 0|1            mutate duplicate tours every generation (%d)\n", config.dedup);
+  printf("  --elites K             best tours carried into every generation, at most %d (%d)\n", MAX_ELITES, config.elites);
+  printf("  --topology T           ring, torus or random island migration (%s)\n", migration_topology_name(config.migration_topology));
+  printf("  --migration-interval N generations between migrations (%d)\n", config.migration_interval);
+  printf("  --migration-size N     elites sent per migration, at most %d (%d)\n", MIGRANT_RING_SLOTS, config.migration_size);
+  printf("  --seed N               random seed (%llu)\n", (unsigned long long) config.seed);
+  printf("  --distance B           auto, dense, triangular, quantized or on-the-fly (%s)\n", distance_backend_name(config.distance_backend));
+  printf("  --verbose 0|1          instance and setup details (%d)\n", config.verbose);
+  printf("  --timing 0|1           per-phase times of every generation (%d)\n", config.timing);
+  printf("  --report 0|1           average phase times in microseconds at the end (%d)\n", config.report);
+  printf("  --trace FILE           write a Chrome/Perfetto timeline of the run to FILE\n");
+  printf("  --checkpoint FILE      save the run to FILE every checkpoint-interval generations\n");
+  printf("  --checkpoint-interval N generations between checkpoints (%d)\n", config.checkpoint_interval);
+  printf("  --resume FILE          continue the run saved in FILE\n");
+  printf("  --tour FILE            write the best tour to FILE in TSPLIB format\n");
+  printf("  --config FILE          read \"key = value\" settings from FILE\n");
+}
+
+// Value of an enum whose name_of(value) is text, for values 0..count-1
+template<typename Enum>
+static bool parse_enum(const char *text, const char* (*name_of)(Enum), int count, Enum *out){
+  int v;
+  for(v = 0; v < count; v++){
+    if(strcmp(text, name_of((Enum) v)) == 0){
+      *out = (Enum) v;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool parse_int(const char *text, int low, int high, int *out){
+  char *end;
+  long v = strtol(text, &end, 10);
+  if(*text == '\0' || *end != '\0' || v < low || v > high) return false;
+  *out = (int) v;
+  return true;
+}
+
+static bool parse_double(const char *text, double low, double *out){
+  char *end;
+  double v = strtod(text, &end);
+  if(*text == '\0' || *end != '\0' || !(v >= low)) return false;
+  *out = v;
+  return true;
+}
+
+bool load_config_file(const char *path);
+
+// Apply one setting; prints what was wrong and returns false on a bad one
+bool set_option(const char *key, const char *value){
+  bool ok;
+  int flag;
+  if(strcmp(key, "population") == 0) ok = parse_int(value, 2, INT32_MAX / 2, &config.population_size);
+  else if(strcmp(key, "generations") == 0) ok = parse_int(value, 0, INT32_MAX, &config.generations);
+  else if(strcmp(key, "time-limit") == 0) ok = parse_double(value, 0, &config.time_limit);
+  else if(strcmp(key, "target") == 0) ok = parse_double(value, 0, &config.target_cost);
+  else if(strcmp(key, "stagnation") == 0) ok = parse_int(value, 0, INT32_MAX, &config.stagnation);
+  else if(strcmp(key, "min-diversity") == 0) ok = parse_double(value, 0, &config.min_diversity);
+  else if(strcmp(key, "threads") == 0) ok = parse_int(value, 1, 4096, &config.threads);
+  else if(strcmp(key, "chunk") == 0) ok = parse_int(value, 0, MAX_CHUNK, &config.chunk);
+  else if(strcmp(key, "mode") == 0) ok = parse_enum(value, generation_mode_name, 4, &config.mode);
+  else if(strcmp(key, "selection") == 0) ok = parse_enum(value, selection_method_name, 4, &config.selection);
+  else if(strcmp(key, "tournament") == 0) ok = parse_int(value, 1, INT32_MAX, &config.tournament_size);
+  else if(strcmp(key, "mutation-chance") == 0) ok = parse_int(value, 0, 100, &config.mutation_chance);
+  else if(strcmp(key, "mutation") == 0) ok = parse_enum(value, mutation_operator_name, 3, &config.mutation_operator);
+  else if(strcmp(key, "local-search") == 0) ok = parse_enum(value, local_search_scope_name, 3, &config.local_search);
+  else if(strcmp(key, "ls-elite") == 0) ok = parse_int(value, 0, 100, &config.local_search_elite);
+  else if(strcmp(key, "neighbors") == 0) ok = parse_int(value, 1, 1024, &config.neighbor_k);
+  else if(strcmp(key, "dedup") == 0){ ok = parse_int(value, 0, 1, &flag); config.dedup = flag; }
+  else if(strcmp(key, "elites") == 0) ok = parse_int(value, 0, MAX_ELITES, &config.elites);
+  else if(strcmp(key, "topology") == 0) ok = parse_enum(value, migration_topology_name, 3, &config.migration_topology);
+  else if(strcmp(key, "migration-interval") == 0) ok = parse_int(value, 1, INT32_MAX, &config.migration_interval);
+  else if(strcmp(key, "migration-size") == 0) ok = parse_int(value, 0, MIGRANT_RING_SLOTS, &config.migration_size);
+  else if(strcmp(key, "seed") == 0){
+    char *end;
+    config.seed = strtoull(value, &end, 10);
+    ok = (*value != '\0' && *end == '\0');
+  }
+  else if(strcmp(key, "distance") == 0) ok = parse_enum(value, distance_backend_name, 5, &config.distance_backend);
+  else if(strcmp(key, "verbose") == 0){ ok = parse_int(value, 0, 1, &flag); config.verbose = flag; }
+  else if(strcmp(key, "timing") == 0){ ok = parse_int(value, 0, 1, &flag); config.timing = flag; }
+  else if(strcmp(key, "report") == 0){ ok = parse_int(value, 0, 1, &flag); config.report = flag; }
+  else if(strcmp(key, "trace") == 0){
+    // Config file values live in a line buffer
+    config.trace = strdup(value);
+    ok = (*value != '\0');
+  }
+  else if(strcmp(key, "checkpoint") == 0){ config.checkpoint = strdup(value); ok = (*value != '\0'); }
+  else if(strcmp(key, "checkpoint-interval") == 0) ok = parse_int(value, 1, INT32_MAX, &config.checkpoint_interval);
+  else if(strcmp(key, "resume") == 0){ config.resume = strdup(value); ok = (*value != '\0'); }
+  else if(strcmp(key, "tour") == 0){ config.tour = strdup(value); ok = (*value != '\0'); }
+  else if(strcmp(key, "config") == 0) return load_config_file(value);
+  else{
+    printf("Unknown option '%s'\n", key);
+    return false;
+  }
+  if(!ok){
+    printf("Bad value '%s' for option '%s'\n", value, key);
+  }
+  return ok;
+}
+
+bool load_config_file(const char *path){
+  FILE *file = fopen(path, "r");
+  if(file == NULL){ perror("(load_config_file) Can't open config file"); return false; }
+  char line[512];
+  int number = 0;
+  bool ok = true;
+  while(ok && fgets(line, sizeof(line), file) != NULL){
+    number++;
+    char *hash = strchr(line, '#');
+    if(hash) *hash = '\0';
+    char key[128], value[384];
+    if(sscanf(line, " %127[^= \t\n] = %383s", key, value) == 2){
+      ok = set_option(key, value);
+    }else if(sscanf(line, " %127s", key) == 1){
+      printf("%s:%d: expected \"key = value\"\n", path, number);
+      ok = false;
+    }
+  }
+  fclose(file);
+  return ok;
+}
+
+// Why params can't be run, or NULL when they can: the ranges the options
+// accept and the settings that only make sense together. It changes
+// nothing, so GASolver (ga_solver.cpp) runs it on its caller's params too.
+const char* validate(const GAConfig &c){
+  if(c.population_size < 2 || c.population_size > INT32_MAX / 2) return "--population must be at least 2";
+  if(c.generations < 0 || c.stagnation < 0) return "--generations and --stagnation can't be negative";
+  if(!(c.time_limit >= 0) || !(c.target_cost >= 0) || !(c.min_diversity >= 0)){
+    return "--time-limit, --target and --min-diversity can't be negative";
+  }
+  if(c.threads < 1 || c.threads > 4096) return "--threads must be between 1 and 4096";
+  if(c.chunk < 0 || c.chunk > MAX_CHUNK) return "--chunk is out of range";
+  if((unsigned) c.mode > STEADY || (unsigned) c.selection > ALIAS || (unsigned) c.mutation_operator > OR_OPT
+     || (unsigned) c.local_search > ALL_MEMBERS || (unsigned) c.migration_topology > RANDOM
+     || (unsigned) c.distance_backend > ON_THE_FLY){
+    return "a choice is out of range";
+  }
+  if(c.tournament_size < 1) return "--tournament must be at least 1";
+  if(c.mutation_chance < 0 || c.mutation_chance > 100) return "--mutation-chance must be between 0 and 100";
+  if(c.local_search_elite < 0 || c.local_search_elite > 100) return "--ls-elite must be between 0 and 100";
+  if(c.neighbor_k < 1 || c.neighbor_k > 1024) return "--neighbors must be between 1 and 1024";
+  if(c.elites < 0 || c.elites > MAX_ELITES) return "--elites is out of range";
+  if(c.migration_interval < 1) return "--migration-interval must be at least 1";
+  if(c.migration_size < 0 || c.migration_size > MIGRANT_RING_SLOTS) return "--migration-size is out of range";
+  if(c.checkpoint_interval < 1) return "--checkpoint-interval must be at least 1";
+
+  if(c.local_search != NO_MEMBERS && c.mode != PHASED){
+    return "Local search is a stage of the phased generation; use --mode phased";
+  }
+  if(c.dedup && c.mode != PHASED){
+    return "Dedup is a stage of the phased generation; use --mode phased";
+  }
+  bool one_pass = (c.mode == ISLANDS || c.mode == STEADY);
+  if((c.checkpoint != NULL || c.resume != NULL) && one_pass){
+    return "Islands and the steady state run in one pass; checkpoints need --mode phased or fused";
+  }
+  if(c.selection != TOURNAMENT && c.mode == ISLANDS){
+    return "Islands select by tournament within their slice; --selection needs --mode phased or fused";
+  }
+  if(c.selection != TOURNAMENT && c.mode == STEADY){
+    return "The steady state selects by tournament on live costs; --selection needs --mode phased or fused";
+  }
+  if(c.elites > 0 && one_pass){
+    return "Elites are carried into every generation; use --mode phased or fused";
+  }
+  if(c.elites >= c.population_size){
+    return "--elites must be smaller than the population";
+  }
+  if(c.generations == 0 && c.time_limit == 0 && c.target_cost == 0 && c.stagnation == 0 && c.min_diversity == 0){
+    return "--generations 0 runs until another stopping policy fires; set one";
+  }
+  if(one_pass && (c.generations == 0 || c.stagnation > 0 || c.min_diversity > 0)){
+    return "Islands and the steady state need a generation limit and stop only on --time-limit or --target";
+  }
+  return NULL;
+}
+
+#define ARGS_ERROR -1 // Bad options, already reported
+#define ARGS_HELP -2  // --help printed the usage
+
+// Parse the command line into config. The instance paths are moved to the
+// front of argv; returns how many there are, or ARGS_ERROR or ARGS_HELP to
+// exit.
+int parse_args(int argc, char **argv){
+  int k, instances = 0;
+  const char *program = argv[0];
+  for(k = 1; k < argc; k++){
+    const char *arg = argv[k];
+    if(strncmp(arg, "--", 2) != 0){
+      argv[instances++] = argv[k];
+      continue;
+    }
+    if(strcmp(arg, "--help") == 0){
+      print_usage(program);
+      return ARGS_HELP;
+    }
+    char key[128];
+    const char *value;
+    const char *equals = strchr(arg, '=');
+    if(equals != NULL){
+      snprintf(key, sizeof(key), "%.*s", (int)(equals - arg - 2), arg + 2);
+      value = equals + 1;
+    }else{
+      snprintf(key, sizeof(key), "%s", arg + 2);
+      if(k + 1 >= argc){
+        printf("Option '%s' needs a value\n", arg);
+        return ARGS_ERROR;
+      }
+      value = argv[++k];
+    }
+    if(!set_option(key, value)){
+      return ARGS_ERROR;
+    }
+  }
+  const char *problem = validate(config);
+  if(problem != NULL){
+    printf("%s\n", problem);
+    return ARGS_ERROR;
+  }
+  if(config.resume != NULL && instances > 1){
+    printf("--resume continues the run of one instance\n");
+    return ARGS_ERROR;
+  }
+  if(config.threads > config.population_size){
+    config.threads = config.population_size;
+  }
+  return instances;
+}
@@ -1,21 +1,93 @@
+#include <stddef.h>
+#include <stdint.h>
 #pragma once
 
-// Debug and timing flags
+// Debug flags (compile time)
 // #define DEBUG
-#define VERBOSE
-#define TIMING
-// #define PARALLEL
-// #define EMBEDDED
+// #define VERIFY_DELTAS // Check every mutation delta against a full re-evaluation
 
-// Configurations Parameters:
-#define POPULATION_SIZE 100000
-#define NUM_CITIES 52
-#define TOURNAMENT_SIZE 128
-#define MUTATION_CHANCE 10 // % Chance
-#define NUM_GENERATIONS 10
-#define NUM_THREADS 4
+// Choices for the run-time parameters below; the files in parentheses
+// implement them
+enum GenerationMode { PHASED, FUSED, ISLANDS, STEADY };        // GA_functions.cpp, islands.cpp, steady_state.cpp
+enum SelectionMethod { TOURNAMENT, RANK, SUS, ALIAS };         // selection.cpp
+enum MutationOperator { SWAP, TWO_OPT, OR_OPT };               // mutation_ops.cpp
+enum LocalSearchScope { NO_MEMBERS, ELITE_MEMBERS, ALL_MEMBERS }; // local_search.cpp
+enum MigrationTopology { RING, TORUS, RANDOM };                // islands.cpp
+enum DistanceBackend { AUTO, DENSE, TRIANGULAR, QUANTIZED, ON_THE_FLY }; // distance.cpp
 
-// Predefined city coordinates
-float city_x[NUM_CITIES] = { 565,25,345,945,845,880,25,525,580,650,1605,1220,1465,1530,845,725,145,415,510,560,300,520,480,835,975,1215,1320,1250,660,410,420,575,1150,700,685,685,770,795,720,760,475,95,875,700,555,830,1170,830,605,595,1340,1740 };//
-float city_y[NUM_CITIES] = { 575.0,185.0,750.0,685.0,655.0,660.0,230.0,1000.0,1175.0,1130.0,620.0 ,580.0,200.0,5.0,680.0,370.0,665.0,635.0,875.0  ,365.0,465.0,585.0,415.0,625.0,580.0,245.0,315.0,400.0,180.0,250.0,555.0,665.0,1160.0,580.0,595.0,610.0,610.0,645.0,635.0,650.0,960.0,260.0,920.0,500.0,815.0,485.0,65.0,610.0,625.0,360.0,725.0,245.0 };
+// Configuration Parameters. Set from the command line or a config file
+// (see config.cpp); the values here are the defaults.
+typedef struct {
+  int population_size;
+  int generations;          // 0: no limit, another stopping policy ends the run
+  double time_limit;        // Seconds of wall time for the run, 0 for no limit (see stopping.cpp)
+  double target_cost;       // Stop once the best cost is at or below it, 0 for off
+  int stagnation;           // Stop after this many generations without improvement, 0 for off
+  double min_diversity;     // Stop when the costs' std/mean drops below it, 0 for off
+  int threads;              // 1 runs every phase on the main thread
+  int chunk;                // Members per scheduling chunk, 0 to tune it per phase (see scheduler.cpp)
+  GenerationMode mode;      // PHASED: five phases per generation
+                            // FUSED: one select/crossover/mutate/evaluate pass per child
+                            // ISLANDS: every thread evolves its own subpopulation
+                            // STEADY: threads replace members in place, no generations
+  SelectionMethod selection;
+  int tournament_size;
+  int mutation_chance;      // % Chance
+  MutationOperator mutation_operator;
+  LocalSearchScope local_search;  // 2-opt/Or-opt stage after mutation (PHASED only)
+  int local_search_elite;   // % of the population improved when the scope is ELITE_MEMBERS
+  int neighbor_k;           // Candidate cities per city for local search moves
+  bool dedup;               // Mutate duplicate tours after mutation (PHASED only, see tour_hash.cpp)
+  int elites;               // Best tours carried unchanged into every generation (see elite.cpp)
+  MigrationTopology migration_topology; // Islands that exchange migrants
+  int migration_interval;   // Generations between migrations
+  int migration_size;       // Elites an island sends to each neighbour per migration
+  uint64_t seed;            // Same seed gives the same run for any thread count
+  DistanceBackend distance_backend;
+  bool verbose;
+  bool timing;              // Per-phase times of every generation
+  bool report;              // Table of the average phase times at the end (microseconds)
+  const char *trace;        // Chrome trace-event file written at exit, NULL for none
+  const char *checkpoint;   // Checkpoint file (see checkpoint.cpp), NULL for none
+  int checkpoint_interval;  // Generations between checkpoints
+  const char *resume;       // Checkpoint to continue from, NULL to start fresh
+  const char *tour;         // File the best tour is written to (TSPLIB .tour), NULL for none
+} GAConfig;
 
+inline GAConfig config = {
+  100000,         // population_size
+  10,             // generations
+  0,              // time_limit
+  0,              // target_cost
+  0,              // stagnation
+  0,              // min_diversity
+  1,              // threads
+  0,              // chunk
+  PHASED,         // mode
+  TOURNAMENT,     // selection
+  128,            // tournament_size
+  10,             // mutation_chance
+  SWAP,           // mutation_operator
+  NO_MEMBERS,     // local_search
+  1,              // local_search_elite
+  8,              // neighbor_k
+  false,          // dedup
+  0,              // elites
+  RING,           // migration_topology
+  5,              // migration_interval
+  2,              // migration_size
+  1,              // seed
+  AUTO,           // distance_backend
+  true,           // verbose
+  true,           // timing
+  false,          // report
+  NULL,           // trace
+  NULL,           // checkpoint
+  10,             // checkpoint_interval
+  NULL,           // resume
+  NULL            // tour
+};
+
+// Number of cities in the instance being solved.
+// Set at runtime from the loaded TSPLIB file (see tsplib.cpp)
+inline int num_cities = 0;
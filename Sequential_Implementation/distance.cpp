@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "consts.cpp"
+#include "tsplib.cpp"
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+#endif
+#pragma once
+
+// Distance providers.
+// Every provider answers dist(a, b) for two city indices. The GA operators
+// are templated on the provider type, so the lookup is inlined into the hot
+// loops instead of going through a function pointer. main() picks the
+// backend from the instance size (see choose_distance_backend).
+//
+//   DenseDistance       full n*n float table, one load per lookup
+//   TriangularDistance  packed upper triangle, half the memory of dense
+//   QuantizedDistance   upper-triangle tiles of 16-bit fixed-point values
+//   CoordDistance       computed from the coordinates on every lookup
+
+
+// Largest instances each table backend is used for when config.distance_backend is AUTO
+#define DENSE_MAX_CITIES 4096        // 64 MB table
+#define TRIANGULAR_MAX_CITIES 16384  // 512 MB table
+#define QUANTIZED_MAX_CITIES 32768   // 1 GB table
+
+// Tiles of QuantizedDistance are QTILE x QTILE entries (8 KB)
+#define QTILE_SHIFT 6
+#define QTILE (1 << QTILE_SHIFT)
+
+// Full matrix, row-major
+struct DenseDistance {
+  float *table;
+  int n;
+  inline float operator()(int a, int b) const {
+    return table[(size_t)a*n + b];
+  }
+};
+
+// Upper triangle without the diagonal, stored row after row.
+// Entry (a, b) with a < b lives at row_offset[a] + b.
+struct TriangularDistance {
+  float *packed;
+  int64_t *row_offset;
+  int n;
+  inline float operator()(int a, int b) const {
+    if(a == b) return 0.0f;
+    if(a > b){ int t = a; a = b; b = t; }
+    return packed[row_offset[a] + b];
+  }
+};
+
+// Upper triangle of QTILE x QTILE tiles (diagonal tiles are stored whole)
+// holding round(distance / scale) as uint16_t. Cities that are close in
+// index share a tile, so lookups along a tour stay within a few pages.
+struct QuantizedDistance {
+  uint16_t *tiles;
+  int64_t *tile_row_offset; // First tile of each tile row
+  float scale;
+  int n;
+  inline float operator()(int a, int b) const {
+    if(a > b){ int t = a; a = b; b = t; }
+    int ta = a >> QTILE_SHIFT, tb = b >> QTILE_SHIFT;
+    int64_t tile = tile_row_offset[ta] + (tb - ta);
+    return scale * tiles[(tile << (2*QTILE_SHIFT)) + ((a & (QTILE-1)) << QTILE_SHIFT) + (b & (QTILE-1))];
+  }
+};
+
+// No table at all; used when even the quantized table would not fit.
+// EUC_2D is computed inline (and vectorized in path_length below), the
+// other coordinate metrics fall back to tsp_distance(). Both round in
+// double like tsp_distance(), so every backend gives the same costs.
+struct CoordDistance {
+  const TSPInstance *inst;
+  const float *x;
+  const float *y;
+  bool euc_2d;
+  inline float operator()(int a, int b) const {
+    if(euc_2d){
+      double dx = x[a] - x[b];
+      double dy = y[a] - y[b];
+      return (float) floor(sqrt(dx*dx + dy*dy) + 0.5);
+    }
+    return (a == b) ? 0.0f : tsp_distance(inst, a, b);
+  }
+};
+
+// Pick a backend for an instance. config.distance_backend in consts.cpp forces one.
+DistanceBackend choose_distance_backend(const TSPInstance *inst){
+  DistanceBackend forced = config.distance_backend;
+  // Explicit weights can't be recomputed on the fly
+  if(forced != AUTO && !(forced == ON_THE_FLY && inst->type == EXPLICIT)){
+    return forced;
+  }
+  if(inst->dimension <= DENSE_MAX_CITIES || inst->type == EXPLICIT){
+    return DENSE; // Explicit weights are already a full matrix
+  }
+  if(inst->dimension <= TRIANGULAR_MAX_CITIES){
+    return TRIANGULAR;
+  }
+  if(inst->dimension <= QUANTIZED_MAX_CITIES){
+    return QUANTIZED;
+  }
+  return ON_THE_FLY;
+}
+
+const char* distance_backend_name(DistanceBackend backend){
+  switch(backend){
+    case DENSE: return "dense";
+    case TRIANGULAR: return "triangular";
+    case QUANTIZED: return "quantized";
+    case ON_THE_FLY: return "on-the-fly";
+    default: return "auto";
+  }
+}
+
+// ---- Construction. Each distance is computed once and mirrored. ----
+// A build returns false when the table doesn't fit in memory; free_distance()
+// is safe to call either way.
+
+bool build_distance(DenseDistance *dist, const TSPInstance *inst){
+  int n = inst->dimension;
+  int k, j;
+  dist->n = n;
+  dist->table = (float *) malloc((size_t)n*n*sizeof(float));
+  if(dist->table == NULL) return false;
+  for(k = 0; k < n; k++){
+    dist->table[(size_t)k*n + k] = 0.0f;
+    for(j = k+1; j < n; j++){
+      float d = tsp_distance(inst, k, j);
+      dist->table[(size_t)k*n + j] = d;
+      dist->table[(size_t)j*n + k] = d;
+    }
+  }
+  return true;
+}
+
+bool build_distance(TriangularDistance *dist, const TSPInstance *inst){
+  int n = inst->dimension;
+  int k, j;
+  dist->n = n;
+  dist->row_offset = (int64_t *) malloc(n*sizeof(int64_t));
+  dist->packed = (float *) malloc(((size_t)n*(n-1)/2 + 1)*sizeof(float));
+  if(dist->row_offset == NULL || dist->packed == NULL) return false;
+  int64_t next = 0;
+  for(k = 0; k < n; k++){
+    // Row k holds columns k+1..n-1; subtract k+1 so the column indexes directly
+    dist->row_offset[k] = next - (k + 1);
+    for(j = k+1; j < n; j++){
+      dist->packed[next++] = tsp_distance(inst, k, j);
+    }
+  }
+  return true;
+}
+
+bool build_distance(QuantizedDistance *dist, const TSPInstance *inst){
+  int n = inst->dimension;
+  int tiles_per_row = (n + QTILE - 1) >> QTILE_SHIFT;
+  int ta, tb, a, b;
+  dist->n = n;
+
+  // Bound the largest distance by the diagonal of the bounding box (plus
+  // rounding slack) so the whole range fits in 16 bits. Integer distances
+  // up to 65535 keep scale 1 and are stored exactly.
+  float max_d = 0.0f;
+  if(inst->type == EXPLICIT){
+    for(size_t e = 0; e < (size_t)n*n; e++){
+      max_d = fmaxf(max_d, inst->weights[e]);
+    }
+  }else if(inst->type == GEO){
+    max_d = 20038.0f; // Half of the earth's circumference in km
+  }else{
+    float min_x = inst->x[0], max_x = inst->x[0], min_y = inst->y[0], max_y = inst->y[0];
+    for(a = 1; a < n; a++){
+      min_x = fminf(min_x, inst->x[a]); max_x = fmaxf(max_x, inst->x[a]);
+      min_y = fminf(min_y, inst->y[a]); max_y = fmaxf(max_y, inst->y[a]);
+    }
+    max_d = ceilf(sqrtf((max_x-min_x)*(max_x-min_x) + (max_y-min_y)*(max_y-min_y))) + 1.0f;
+    if(inst->type == ATT){
+      max_d = max_d / sqrtf(10.0f) + 1.0f;
+    }
+  }
+  dist->scale = (max_d <= 65535.0f) ? 1.0f : max_d / 65535.0f;
+
+  dist->tiles = NULL;
+  dist->tile_row_offset = (int64_t *) malloc(tiles_per_row*sizeof(int64_t));
+  if(dist->tile_row_offset == NULL) return false;
+  int64_t num_tiles = 0;
+  for(ta = 0; ta < tiles_per_row; ta++){
+    dist->tile_row_offset[ta] = num_tiles - ta; // Indexed by tb >= ta
+    num_tiles += tiles_per_row - ta;
+  }
+  size_t entries = (size_t)num_tiles << (2*QTILE_SHIFT);
+  dist->tiles = (uint16_t *) calloc(entries, sizeof(uint16_t));
+  if(dist->tiles == NULL) return false;
+
+  for(ta = 0; ta < tiles_per_row; ta++){
+    for(tb = ta; tb < tiles_per_row; tb++){
+      uint16_t *tile = dist->tiles + ((dist->tile_row_offset[ta] + tb) << (2*QTILE_SHIFT));
+      for(a = ta*QTILE; a < n && a < (ta+1)*QTILE; a++){
+        for(b = tb*QTILE; b < n && b < (tb+1)*QTILE; b++){
+          float q = (a == b) ? 0.0f : fminf(tsp_distance(inst, a, b) / dist->scale, 65535.0f);
+          tile[((a & (QTILE-1)) << QTILE_SHIFT) + (b & (QTILE-1))] = (uint16_t) lrintf(q);
+        }
+      }
+    }
+  }
+  return true;
+}
+
+bool build_distance(CoordDistance *dist, const TSPInstance *inst){
+  dist->inst = inst;
+  dist->x = inst->x;
+  dist->y = inst->y;
+  dist->euc_2d = (inst->type == EUC_2D);
+  return true;
+}
+
+void free_distance(DenseDistance *dist){ free(dist->table); dist->table = NULL; }
+void free_distance(TriangularDistance *dist){
+  free(dist->packed); free(dist->row_offset);
+  dist->packed = NULL; dist->row_offset = NULL;
+}
+void free_distance(QuantizedDistance *dist){
+  free(dist->tiles); free(dist->tile_row_offset);
+  dist->tiles = NULL; dist->tile_row_offset = NULL;
+}
+void free_distance(CoordDistance *dist){ (void) dist; }
+
+// ---- Tour length ----
+
+// Length of the path genes[0] -> genes[1] -> ... -> genes[num_cities-1]
+template<typename Gene, typename Dist>
+inline float path_length(const Dist &dist, const Gene *genes){
+  float total = 0.0;
+  int j;
+  for(j = 1; j < num_cities; j++){
+    total += dist(genes[j-1], genes[j]);
+  }
+  return total;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Eight consecutive genes widened to 32-bit indices
+__attribute__((target("avx2")))
+static inline __m256i load_genes8(const uint8_t *g){
+  return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) g));
+}
+__attribute__((target("avx2")))
+static inline __m256i load_genes8(const uint16_t *g){
+  return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) g));
+}
+__attribute__((target("avx2")))
+static inline __m256i load_genes8(const uint32_t *g){
+  return _mm256_loadu_si256((const __m256i *) g);
+}
+
+// Rounded EUC_2D distances of four edges from their float deltas, in double
+__attribute__((target("avx2")))
+static inline __m128 euc2d_round4(__m128 dx, __m128 dy){
+  __m256d x = _mm256_cvtps_pd(dx), y = _mm256_cvtps_pd(dy);
+  __m256d d = _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(x, x), _mm256_mul_pd(y, y)));
+  return _mm256_cvtpd_ps(_mm256_floor_pd(_mm256_add_pd(d, _mm256_set1_pd(0.5))));
+}
+
+// EUC_2D path length, eight edges at a time, coordinates gathered per edge
+template<typename Gene>
+__attribute__((target("avx2")))
+float path_length_euc2d_avx2(const CoordDistance &dist, const Gene *genes){
+  __m256 total = _mm256_setzero_ps();
+  int j = 1;
+  for(; j + 8 <= num_cities; j += 8){
+    __m256i from = load_genes8(genes + j - 1);
+    __m256i to = load_genes8(genes + j);
+    __m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(dist.x, from, 4), _mm256_i32gather_ps(dist.x, to, 4));
+    __m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(dist.y, from, 4), _mm256_i32gather_ps(dist.y, to, 4));
+    __m256 d = _mm256_set_m128(euc2d_round4(_mm256_extractf128_ps(dx, 1), _mm256_extractf128_ps(dy, 1)),
+                               euc2d_round4(_mm256_castps256_ps128(dx), _mm256_castps256_ps128(dy)));
+    total = _mm256_add_ps(total, d);
+  }
+  float lanes[8];
+  _mm256_storeu_ps(lanes, total);
+  float sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+  for(; j < num_cities; j++){
+    sum += dist(genes[j-1], genes[j]);
+  }
+  return sum;
+}
+#endif
+
+// On-the-fly distances take the SIMD path when the CPU supports it
+template<typename Gene>
+inline float path_length(const CoordDistance &dist, const Gene *genes){
+  #if defined(__x86_64__) || defined(__i386__)
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    if(dist.euc_2d && has_avx2){
+      return path_length_euc2d_avx2(dist, genes);
+    }
+  #endif
+  float total = 0.0;
+  int j;
+  for(j = 1; j < num_cities; j++){
+    total += dist(genes[j-1], genes[j]);
+  }
+  return total;
+}
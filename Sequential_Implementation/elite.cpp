@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "consts.cpp"
+#include "population.cpp"
+#include "tour_hash.cpp"
+#pragma once
+
+// Best members of a generation and the elite archive.
+// Every pool thread keeps the k cheapest members of its slice in its own
+// TopK while it evaluates them (see cost_update_slice); main merges the
+// per-thread lists, k entries each, instead of scanning the population.
+// The merged list updates the EliteArchive, which holds copies of the k
+// best tours seen so far, so the best tour can be read at any time and
+// survives the buffer swaps. With config.elites > 0 the archive's tours
+// are carried unchanged into members [0, elites) of every new generation
+// (elitism): crossover and mutation skip those members, so no copy of the
+// rest of the population is needed and the best cost never goes up.
+
+// Most members a TopK or the archive can hold
+#define MAX_ELITES 64
+
+typedef struct {
+  float cost;
+  int member;
+} EliteEntry;
+
+// The k cheapest members offered, cheapest first; equal costs are ordered
+// by member index so the result doesn't depend on the thread count
+typedef struct {
+  alignas(CACHE_LINE) int k;
+  int count;
+  EliteEntry e[MAX_ELITES];
+} TopK;
+
+// Members the archive keeps and the TopK lists track
+inline int elite_count(){
+  return config.elites > 0 ? config.elites : 1;
+}
+
+inline void topk_reset(TopK *t, int k){
+  t->k = k;
+  t->count = 0;
+}
+
+static inline bool elite_before(float cost, int member, const EliteEntry &e){
+  return cost < e.cost || (cost == e.cost && member < e.member);
+}
+
+inline void topk_offer(TopK *t, float cost, int member){
+  int j = t->count;
+  // Most members don't beat the current k-th
+  if(j == t->k && !elite_before(cost, member, t->e[j-1])) return;
+  if(j < t->k) t->count++;
+  else j--;
+  while(j > 0 && elite_before(cost, member, t->e[j-1])){
+    t->e[j] = t->e[j-1];
+    j--;
+  }
+  t->e[j].cost = cost;
+  t->e[j].member = member;
+}
+
+// Merge count lists into out
+void topk_merge(TopK *out, const TopK *lists, int count){
+  int t, j;
+  topk_reset(out, lists[0].k);
+  for(t = 0; t < count; t++){
+    for(j = 0; j < lists[t].count; j++){
+      topk_offer(out, lists[t].e[j].cost, lists[t].e[j].member);
+    }
+  }
+}
+
+template<typename Gene>
+struct EliteArchive {
+  int k, count;
+  Gene *genes;   // count tours, cheapest first
+  Gene *scratch; // Next contents while updating
+  float cost[MAX_ELITES];
+  uint64_t hash[MAX_ELITES];  // See tour_hash.cpp
+  int generation[MAX_ELITES]; // Generation that produced each tour, -1 for the initial population
+};
+
+// False when out of memory; archive_free() releases what was allocated
+template<typename Gene>
+bool archive_init(EliteArchive<Gene> *a, int k){
+  a->k = k;
+  a->count = 0;
+  a->genes = (Gene *) malloc((size_t)k*num_cities*sizeof(Gene));
+  a->scratch = (Gene *) malloc((size_t)k*num_cities*sizeof(Gene));
+  return a->genes != NULL && a->scratch != NULL;
+}
+
+template<typename Gene>
+void archive_free(EliteArchive<Gene> *a){
+  free(a->genes);
+  free(a->scratch);
+}
+
+// Tours of the archive
+template<typename Gene>
+inline Gene* archive_tour(const EliteArchive<Gene> *a, int j){
+  return a->genes + (size_t)j*num_cities;
+}
+
+// Keep the k best of the archive and the generation's best members top
+// (members of pop). Tours are compared by hash, so a member that is a copy
+// of an archived tour, like an elite carried over, is kept once; on equal
+// costs the archived tour comes first.
+template<typename Gene>
+void archive_update(EliteArchive<Gene> *a, Gene *pop, const TopK *top, int generation){
+  size_t tour_bytes = num_cities*sizeof(Gene);
+  float cost[MAX_ELITES];
+  int from[MAX_ELITES];
+  uint64_t hash[MAX_ELITES];
+  int i = 0, j = 0, n = 0, k;
+  while(n < a->k && (i < a->count || j < top->count)){
+    const Gene *tour;
+    float c;
+    uint64_t h;
+    int g;
+    if(j >= top->count || (i < a->count && a->cost[i] <= top->e[j].cost)){
+      tour = archive_tour(a, i);
+      c = a->cost[i];
+      h = a->hash[i];
+      g = a->generation[i];
+      i++;
+    }else{
+      tour = chromosome(pop, top->e[j].member);
+      c = top->e[j].cost;
+      h = tour_hash(tour);
+      g = generation;
+      j++;
+    }
+    for(k = 0; k < n && hash[k] != h; k++);
+    if(k < n) continue;
+    memcpy(a->scratch + (size_t)n*num_cities, tour, tour_bytes);
+    cost[n] = c;
+    hash[n] = h;
+    from[n] = g;
+    n++;
+  }
+  Gene *temp = a->genes;
+  a->genes = a->scratch;
+  a->scratch = temp;
+  memcpy(a->cost, cost, n*sizeof(float));
+  memcpy(a->hash, hash, n*sizeof(uint64_t));
+  memcpy(a->generation, from, n*sizeof(int));
+  a->count = n;
+}
+
+// Copy the archive into members [0, count) of a population buffer with
+// valid costs, and their hashes when hashes isn't NULL. An archive with
+// fewer tours (a population of few distinct tours) fills them in turn.
+template<typename Gene>
+void archive_inject(const EliteArchive<Gene> *a, Gene *pop, float *cost, uint8_t *cost_valid,
+                    uint64_t *hashes, int count){
+  int j;
+  for(j = 0; j < count; j++){
+    int src = j % a->count;
+    memcpy(chromosome(pop, j), archive_tour(a, src), num_cities*sizeof(Gene));
+    cost[j] = a->cost[src];
+    cost_valid[j] = 1;
+    if(hashes) hashes[j] = a->hash[src];
+  }
+}
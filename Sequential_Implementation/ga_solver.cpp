@@ -0,0 +1,873 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <new>
+#include "ga_solver.h"
+#include "config.cpp"
+#include "tsplib.cpp"
+#include "GA_functions_parallel.cpp"
+#include "thread_pool.cpp"
+#include "transport.cpp"
+#include "checkpoint.cpp"
+
+// The GA engine behind GASolver (see ga_solver.h). SolverCore holds what
+// used to be the locals of main's run loop, for one gene type and distance
+// provider; GASolver picks the instantiation that suits the instance, as
+// main did, and keeps it across reset() while the next instance fits.
+
+#ifdef DEBUG
+template<typename Gene>
+void check_population(const Gene *pop){
+  int i, j;
+  for(i=0; i<config.population_size; i++){
+    for(j=0; j<num_cities; j++){
+      if((int)chromosome(pop, i)[j] >= num_cities){
+        printf("Population member %d has invalid city %d at index %d\n", i, chromosome(pop, i)[j], j);
+      }
+    }
+  }
+}
+#endif
+
+// Least of the per-thread minimums
+float min_of(const float *min, int count){
+  float min_cost = min[0];
+  for(int i=1; i<count; i++){
+    if(min[i] < min_cost){
+      min_cost = min[i];
+    }
+  }
+  return min_cost;
+}
+
+// ---- Instances ----
+
+TSPInstance* ga_load_instance(const char *path){
+  TSPInstance *inst = (TSPInstance *) malloc(sizeof(TSPInstance));
+  if(inst == NULL || !load_tsplib(path, inst)){
+    free(inst);
+    return NULL;
+  }
+  return inst;
+}
+
+TSPInstance* ga_make_instance(const char *name, int count, const float *x, const float *y){
+  TSPInstance *inst = (TSPInstance *) calloc(1, sizeof(TSPInstance));
+  if(inst == NULL) return NULL;
+  snprintf(inst->name, sizeof(inst->name), "%s", name);
+  inst->dimension = count;
+  inst->type = EUC_2D;
+  inst->format = NO_FORMAT;
+  inst->x = (float *) malloc(count*sizeof(float));
+  inst->y = (float *) malloc(count*sizeof(float));
+  if(inst->x == NULL || inst->y == NULL){
+    ga_free_instance(inst);
+    return NULL;
+  }
+  memcpy(inst->x, x, count*sizeof(float));
+  memcpy(inst->y, y, count*sizeof(float));
+  return inst;
+}
+
+void ga_free_instance(TSPInstance *inst){
+  if(inst == NULL) return;
+  tsp_free(inst);
+  free(inst);
+}
+
+int ga_instance_cities(const TSPInstance *inst){
+  return inst->dimension;
+}
+
+const char* ga_instance_name(const TSPInstance *inst){
+  return inst->name;
+}
+
+// ---- Engine ----
+
+// What GASolver needs from a SolverCore of any instantiation
+struct GASolverImpl {
+  GACallback callback;
+  void *user;
+  DistanceBackend backend;
+  size_t gene_bytes;
+  int capacity;          // Most cities the buffers hold
+  int cities;            // Cities of the current instance
+  const char *error;
+  bool done;             // The run is over
+  int generation_count;  // Next generation to produce; also keys the random streams
+  int resumed;
+  long duplicates_total;
+  long steady_replaced, steady_dropped;
+  int checkpoints_written, checkpoints_skipped;
+  double elapsed;        // Frozen when the run ends
+  StopClock clock;       // This run's time budget and stop request
+
+  virtual ~GASolverImpl(){}
+  virtual void start(const TSPInstance *inst) = 0;
+  virtual bool step() = 0;
+  virtual void finish() = 0;
+  virtual float best_cost() const = 0;
+  virtual int best_generation() const = 0;
+  virtual void best_tour(int *tour) const = 0;
+  virtual bool process_info(int *rank, int *nprocs, const char **transport) const = 0;
+  virtual void print_timing(int generation) = 0;
+  virtual void print_scheduler() const = 0;
+  virtual void print_report() const = 0;
+};
+
+template<typename Gene, typename Dist>
+struct SolverCore : GASolverImpl {
+  Instrument instrument; // Phase and per-thread timing (see instrument.cpp)
+  bool instrumented;
+  ThreadPool pool;
+  TH_args<Gene, Dist> *thread_args;
+  ChunkScheduler sched; // Chunks of the population-parallel phases, stolen across threads
+  int thread_range;     // The range of the population a single thread should handle, rounded up
+  bool islands, steady, local_search_on;
+  Migration<Gene> migration; // ISLANDS: one island per thread
+  float *island_min;         // ISLANDS: generations x threads minimums
+  SteadyState steady_state;  // STEADY: slot locks and progress
+  PopArena<Gene> arena;      // The population and costs, current and next generation
+  int *parents;              // Selected parents to create next generation
+  SelectionTables select;    // Per-generation tables of the selection engine
+  Dist dist;                 // Distances between cities
+  NeighborLists neighbors;   // Candidate cities for the local search moves
+  bool built;                // A run is set up; finish() releases it
+  LsCutoff ls_cutoff;        // Members to improve this generation
+  float *ls_scratch;
+  LocalSearchScratch *ls_work; // One per thread, sized by the capacity
+  uint64_t *used_work;       // One used bitset per thread, sized by the capacity
+  TopK *top;                 // Fittest members of every thread's chunks
+  TopK best;                 // ... merged into the generation's best
+  EliteArchive<Gene> archive; // Best tours of the run so far, and the elites
+  StopTracker tracker;       // Best cost and the stopping policies' state
+  uint64_t *hashes;          // Tour hash of each member, kept by the operators when --dedup is on
+  TourTable tours;           // Hashes of the generation, to find duplicates
+  int *duplicates;           // Duplicates each thread replaced in the generation
+  Transport transport;       // Migration to the job's other processes
+  bool multi_process;
+  void *migrant_buf;
+  Checkpointer checkpointer; // Writes checkpoints in the background
+  bool checkpointing;
+  char instance[64];
+  float min_cost;
+  int *tour_buf;             // Best tour as ints, for the callback
+
+  // Everything sized by the population, the threads or the capacity
+  SolverCore(int cities, DistanceBackend distance_backend){
+    int i;
+    backend = distance_backend;
+    gene_bytes = sizeof(Gene);
+    capacity = cities;
+    this->cities = cities;
+    num_cities = cities;
+    callback = NULL;
+    user = NULL;
+    error = NULL;
+    done = true;
+    generation_count = 0;
+    resumed = -1;
+    duplicates_total = steady_replaced = steady_dropped = 0;
+    checkpoints_written = checkpoints_skipped = 0;
+    elapsed = 0;
+    memset(&clock, 0, sizeof(clock));
+
+    // Nothing is released twice if a run fails to set up
+    memset(&dist, 0, sizeof(dist));
+    memset(&neighbors, 0, sizeof(neighbors));
+    pool.threads = NULL;
+    pool.num_threads = config.threads;
+
+    instrumented = config.timing || config.report;
+    bool ok = instrument_init(&instrument, config.threads, instrumented);
+    islands = (config.mode == ISLANDS);
+    steady = (config.mode == STEADY);
+    local_search_on = (config.local_search != NO_MEMBERS);
+    island_min = islands ? (float*)malloc((size_t)config.generations*config.threads*sizeof(float)) : NULL;
+    ok &= arena_init(&arena);
+    parents = (int*)calloc(config.population_size*2, sizeof(int));
+    ok &= selection_init(&select, config.selection);
+    built = false;
+    ls_scratch = local_search_on ? (float*)malloc(config.population_size*sizeof(float)) : NULL;
+    ls_work = local_search_on ? (LocalSearchScratch*)calloc(config.threads, sizeof(LocalSearchScratch)) : NULL;
+    top = (TopK*)aligned_alloc(CACHE_LINE, config.threads*sizeof(TopK));
+    used_work = used_scratch_alloc(config.threads);
+    ok &= archive_init(&archive, elite_count());
+    hashes = NULL;
+    duplicates = NULL;
+    if(config.dedup){
+      hashes = (uint64_t*)malloc(config.population_size*sizeof(uint64_t));
+      ok &= tour_table_init(&tours);
+      duplicates = (int*)calloc(config.threads, sizeof(int));
+      ok &= (hashes != NULL && duplicates != NULL);
+    }
+    multi_process = false;
+    migrant_buf = NULL;
+    checkpointing = false;
+    tour_buf = (int*)malloc(capacity*sizeof(int));
+    ok &= scheduler_init(&sched, config.threads);
+    thread_args = (TH_args<Gene, Dist> *)calloc(config.threads, sizeof(TH_args<Gene, Dist>));
+    ok &= (parents != NULL && top != NULL && used_work != NULL && tour_buf != NULL && thread_args != NULL);
+    ok &= (!islands || island_min != NULL) && (!local_search_on || (ls_scratch != NULL && ls_work != NULL));
+    if(!ok){
+      error = "out of memory for the population and the solver's tables";
+      return;
+    }
+
+    thread_range = (config.population_size + config.threads - 1) / config.threads;
+    for(i=0; i < config.threads; i++){
+      thread_args[i].arena = &arena;
+      thread_args[i].parents = parents;
+      thread_args[i].select = &select;
+      thread_args[i].dist = &dist;
+      thread_args[i].neighbors = &neighbors;
+      thread_args[i].ls_cutoff = &ls_cutoff;
+      thread_args[i].ls_scratch = NULL;
+      thread_args[i].used = used_work + (size_t)i*used_stride();
+      if(local_search_on){
+        ok &= ls_scratch_init(&ls_work[i]);
+        thread_args[i].ls_scratch = &ls_work[i];
+      }
+      thread_args[i].start = (i * thread_range);
+      thread_args[i].end = ((i+1)* thread_range);
+      if (thread_args[i].end > config.population_size){
+        thread_args[i].end = config.population_size;
+      }
+      thread_args[i].seed = config.seed;
+      thread_args[i].generation = &generation_count;
+      thread_args[i].top = top;
+      thread_args[i].thrdIdx = i;
+      thread_args[i].transport = NULL;
+      thread_args[i].migration = islands ? &migration : NULL;
+      thread_args[i].island_min = island_min;
+      thread_args[i].hashes = hashes;
+      thread_args[i].tours = &tours;
+      thread_args[i].duplicates = duplicates;
+      thread_args[i].sched = &sched;
+      thread_args[i].steady = &steady_state;
+      scheduler_set_slice(&sched, i, thread_args[i].start, thread_args[i].end);
+    }
+    if(!ok){
+      error = "out of memory for the local search";
+      return;
+    }
+    // Workers live as long as the solver and are parked between phases;
+    // with one thread every phase runs on the caller's thread
+    if(!pool_init(&pool, config.threads, thread_args, sizeof(TH_args<Gene, Dist>), instrument.probes)){
+      error = "can't start the worker threads";
+    }
+  }
+
+  ~SolverCore(){
+    int i;
+    finish();
+    pool_destroy(&pool);
+    instrument_free(&instrument);
+    free(thread_args);
+    scheduler_free(&sched);
+    arena_free(&arena);
+    free(parents);
+    selection_free(&select);
+    free(ls_scratch);
+    if(ls_work != NULL){
+      for(i=0; i < config.threads; i++){
+        ls_scratch_free(&ls_work[i]);
+      }
+      free(ls_work);
+    }
+    free(top);
+    free(used_work);
+    archive_free(&archive);
+    if(config.dedup){
+      free(hashes);
+      tour_table_free(&tours);
+      free(duplicates);
+    }
+    free(island_min);
+    free(tour_buf);
+  }
+
+  // Give up on the run being set up: error says why, and finish()
+  // releases what start() got
+  void fail(const char *why){
+    error = why;
+    phase_end(&instrument, 0);
+    finish();
+  }
+
+  // Set up a run on inst and evaluate its initial population
+  void start(const TSPInstance *inst){
+    int i;
+    stop_begin(); // The time budget counts from here (see stopping.cpp)
+    cities = num_cities = inst->dimension;
+    snprintf(instance, sizeof(instance), "%s", inst->name);
+    error = NULL;
+    done = false;
+    generation_count = 0;
+    resumed = -1;
+    duplicates_total = steady_replaced = steady_dropped = 0;
+    checkpoints_written = checkpoints_skipped = 0;
+    instrument_restart(&instrument);
+    phase_begin(&instrument, PHASE_INIT);
+    built = true;
+
+    if(islands){
+      if(!migration_init(&migration, config.threads, config.migration_topology, config.seed)){
+        fail("out of memory for the migrant rings");
+        return;
+      }
+      // Generations an island didn't finish stay at INFINITY
+      for(size_t k = 0; k < (size_t)config.generations*config.threads; k++){
+        island_min[k] = INFINITY;
+      }
+    }
+    multi_process = transport_open<Gene>(&transport);
+    migrant_buf = multi_process ? malloc(transport.max_message) : NULL;
+    if(multi_process && migrant_buf == NULL){
+      fail("out of memory for the migrant buffer");
+      return;
+    }
+    for(i=0; i < config.threads; i++){
+      thread_args[i].transport = multi_process ? &transport : NULL;
+      thread_args[i].seed = config.seed;
+    }
+
+    // Build Cost Table
+    if(!build_distance(&dist, inst)){
+      fail("out of memory for the distance table");
+      return;
+    }
+    if(local_search_on && !build_neighbors(&neighbors, inst, dist, config.neighbor_k)){
+      fail("out of memory for the neighbor lists");
+      return;
+    }
+
+    // Initialize Population, or restore the one of a checkpointed run
+    int restored = -1;
+    if(config.resume != NULL){
+      restored = checkpoint_load(config.resume, &arena, &archive, &tracker, inst->name);
+      if(restored == CHECKPOINT_OTHER){
+        fail("the checkpoint to resume from is of another instance");
+        return;
+      }
+      if(restored < 0){
+        fail("the checkpoint to resume from can't be used");
+        return;
+      }
+    }
+    if(restored >= 0){
+      generation_count = resumed = restored;
+      // The streams continue from the checkpoint's seed
+      for(i=0; i < config.threads; i++){
+        thread_args[i].seed = config.seed;
+      }
+    }else{
+      initialize_population(arena.cur, config.seed);
+      // Nothing of a previous run's costs carries over
+      memset(arena.cost_valid, 0, config.population_size);
+    }
+    if(config.checkpoint != NULL){
+      if(!checkpoint_open<Gene>(&checkpointer, config.checkpoint)){
+        fail("can't start the checkpoint writer");
+        return;
+      }
+      checkpointing = true;
+    }
+    #ifdef DEBUG
+      check_population(arena.cur);
+    #endif
+
+    // Cost Evaluation, on every worker's slice, which also finds the fittest
+    pool_run_chunked(&pool, &sched, cost_update_slice<Gene, Dist>, "cost update");
+    topk_merge(&best, top, config.threads);
+    min_cost = best.e[0].cost;
+    if(restored >= 0){
+      // The checkpoint's archive already holds these members
+      archive_update(&archive, arena.cur, &best, restored - 1);
+    }else{
+      archive.count = 0;
+      archive_update(&archive, arena.cur, &best, -1);
+      stop_tracker_init(&tracker, min_cost);
+    }
+    if(steady && !steady_init(&steady_state, config.threads, min_cost)){
+      fail("out of memory for the steady-state tables");
+      return;
+    }
+    phase_end(&instrument, 0);
+    stop_arm_budget();
+  }
+
+  // End the run: wait for the last checkpoint and release what only this
+  // instance used. Safe to call more than once.
+  void finish(){
+    if(!built) return;
+    if(!done) elapsed = stop_elapsed_s(&clock);
+    done = true;
+    if(checkpointing){
+      // Waits for the last checkpoint to reach the disk
+      checkpoint_close(&checkpointer);
+      checkpoints_written = checkpointer.written;
+      checkpoints_skipped = checkpointer.skipped;
+      checkpointing = false;
+    }
+    if(multi_process){
+      transport_close(&transport);
+      free(migrant_buf);
+      migrant_buf = NULL;
+    }
+    if(steady && error == NULL){
+      for(int i=0; i<config.threads; i++){
+        steady_replaced += steady_state.replaced[i];
+        steady_dropped += steady_state.dropped[i];
+      }
+      steady_free(&steady_state);
+    }
+    if(islands){
+      migration_free(&migration);
+    }
+    free_distance(&dist);
+    if(local_search_on){
+      free_neighbors(&neighbors);
+    }
+    built = false;
+  }
+
+  // Hand a finished generation to the callback; false when it asks to stop
+  bool report(int generation, float generation_min, float best_cost, int best_generation, uint64_t ns){
+    if(callback == NULL) return true;
+    GAGeneration g;
+    g.generation = generation;
+    g.min_cost = generation_min;
+    g.best_cost = best_cost;
+    g.best_generation = best_generation;
+    best_tour(tour_buf);
+    g.best_tour = tour_buf;
+    g.cities = cities;
+    g.generation_ns = ns;
+    g.elapsed_s = stop_elapsed_s(&clock);
+    return callback(&g, user);
+  }
+
+  // Report a one-pass mode's generations from its per-generation minimums
+  void report_pass(const float *generation_min, int generations){
+    float best_cost = tracker.best_cost;
+    int best_generation = -1, g;
+    for(g = 0; g < generations; g++){
+      if(generation_min[g] < best_cost){
+        best_cost = generation_min[g];
+        best_generation = g;
+      }
+      if(!report(g, generation_min[g], best_cost, best_generation, 0)) break;
+    }
+  }
+
+  // ISLANDS: every island runs all its generations in one pool phase and
+  // leaves its final slice in the arena's current buffers
+  void run_islands(){
+    int i;
+    generation_begin(&instrument, -1);
+    phase_begin(&instrument, PHASE_ISLANDS);
+    pool_run(&pool, island_slice<Gene, Dist>);
+    // The generations every island finished
+    float *generation_min = (float*)malloc((size_t)config.generations*sizeof(float));
+    for(generation_count = 0; generation_count < config.generations; generation_count++){
+      const float *island = island_min + (size_t)generation_count*config.threads;
+      for(i=0; i < config.threads && island[i] != INFINITY; i++);
+      if(i < config.threads) break;
+      generation_min[generation_count] = min_of(island, config.threads);
+    }
+    stop_now(STOP_GENERATIONS); // Unless a time budget or target stopped them first
+    // The islands keep no history; the archive takes the best of their final members
+    topk_reset(&best, elite_count());
+    findleastcost(arena.cost, 0, config.population_size, &best);
+    archive_update(&archive, arena.cur, &best, generation_count - 1);
+    phase_end(&instrument, 0);
+    // Report the per-generation average over the complete generations
+    generation_end(&instrument);
+    instrument.generations = generation_count;
+    report_pass(generation_min, generation_count);
+    free(generation_min);
+  }
+
+  // STEADY: every thread breeds into the shared population until the run is over
+  void run_steady(){
+    generation_begin(&instrument, -1);
+    phase_begin(&instrument, PHASE_STEADY);
+    pool_run(&pool, steady_slice<Gene, Dist>);
+    // The generations' worth of children that were completed
+    for(generation_count = 0; generation_count < config.generations; generation_count++){
+      if(steady_state.generation_min[generation_count] == INFINITY) break;
+    }
+    stop_now(STOP_GENERATIONS); // Unless a time budget or target stopped it first
+    topk_reset(&best, elite_count());
+    findleastcost(arena.cost, 0, config.population_size, &best);
+    // The last children may belong to a generation that wasn't completed
+    long started = steady_state.tickets < (long)config.generations*config.population_size
+                   ? steady_state.tickets : (long)config.generations*config.population_size;
+    archive_update(&archive, arena.cur, &best, (int)((started - 1) / config.population_size));
+    phase_end(&instrument, 0);
+    generation_end(&instrument);
+    instrument.generations = generation_count;
+    report_pass(steady_state.generation_min, generation_count);
+  }
+
+  // One generation of the PHASED or FUSED mode. Every phase ends early once
+  // the time budget runs out; a generation that doesn't finish within the
+  // budget is dropped. Returns true when it was completed.
+  bool generation(){
+    int i;
+    bool complete = false;
+    generation_begin(&instrument, generation_count);
+    do{
+      phase_begin(&instrument, config.mode == FUSED ? PHASE_FUSED : PHASE_SELECTION);
+      // Tours sent by the job's other processes replace the worst members
+      if(multi_process){
+        uint64_t t = trace_now();
+        process_immigrate(&transport, &arena, dist, 0, config.population_size, migrant_buf);
+        trace_complete("Process immigrate", t, generation_count);
+      }
+
+      // Build the selection engine's tables for the current costs
+      if(select.method == RANK){
+        pool_run(&pool, rank_sort_slice<Gene, Dist>);
+        // Merge the sorted slices into one order
+        for(i=1; i<config.threads; i++){
+          rank_merge(&select, thread_args[i].start, thread_args[i].end);
+        }
+      }
+      selection_prepare(&select, arena.cost, rng_key(config.seed, generation_count, RNG_SELECTION));
+
+      if(config.mode == FUSED){
+        // Select, crossover, mutate and evaluate each child in a single pass
+        pool_run_chunked(&pool, &sched, generation_fused_slice<Gene, Dist>, "fused");
+        phase_end(&instrument, 0);
+        if(stop_requested()) break;
+        topk_merge(&best, top, config.threads);
+        // The elites and the children become the current population
+        archive_inject(&archive, arena.next, arena.next_cost, arena.next_valid, NULL, config.elites);
+        arena_swap(&arena);
+        for(i=0; i<config.elites; i++){
+          topk_offer(&best, arena.cost[i], i);
+        }
+        min_cost = best.e[0].cost;
+      }else{
+        // Select Parents
+        pool_run_chunked(&pool, &sched, selection_slice<Gene, Dist>, "selection");
+        phase_end(&instrument, 2L*config.population_size);
+        if(stop_requested()) break;
+        #ifdef DEBUG
+          for(i=0; i<config.population_size*2; i++){
+            if(parents[i] < 0 || parents[i] >= config.population_size){
+              printf("Parent %d has invalid value %d\n", i, parents[i]);
+            }
+          }
+        #endif
+
+        // Crossover
+        phase_begin(&instrument, PHASE_CROSSOVER);
+        pool_run_chunked(&pool, &sched, crossover_slice<Gene, Dist>, "crossover");
+        phase_end(&instrument, 0);
+        if(stop_requested()) break;
+        // The elites and the children become the current population
+        archive_inject(&archive, arena.next, arena.next_cost, arena.next_valid, hashes, config.elites);
+        arena_swap(&arena);
+        #ifdef DEBUG
+          check_population(arena.cur);
+        #endif
+
+        // Mutation
+        phase_begin(&instrument, PHASE_MUTATION);
+        pool_run_chunked(&pool, &sched, mutation_slice<Gene, Dist>, "mutation");
+        phase_end(&instrument, 0);
+        if(stop_requested()) break;
+
+        if(local_search_on){
+          // Local search on the elite (or every member)
+          phase_begin(&instrument, PHASE_LOCAL_SEARCH);
+          ls_cutoff = local_search_cutoff(arena.cost, ls_scratch);
+          pool_run_chunked(&pool, &sched, local_search_slice<Gene, Dist>, "local search");
+          phase_end(&instrument, 0);
+          if(stop_requested()) break;
+        }
+        if(config.dedup){
+          // One extra mutation for every tour that already has a copy
+          phase_begin(&instrument, PHASE_DEDUP);
+          pool_run_chunked(&pool, &sched, dedup_record_slice<Gene, Dist>, "dedup record");
+          pool_run_chunked(&pool, &sched, dedup_replace_slice<Gene, Dist>, "dedup replace");
+          pool_run(&pool, dedup_clear_slice<Gene, Dist>);
+          for(i=0; i<config.threads; i++){
+            duplicates_total += duplicates[i];
+          }
+          phase_end(&instrument, 0);
+        }
+        #ifdef DEBUG
+          check_population(arena.cur);
+        #endif
+
+        // Population's Fitness
+        phase_begin(&instrument, PHASE_COST_UPDATE);
+        pool_run_chunked(&pool, &sched, cost_update_slice<Gene, Dist>, "cost update");
+        phase_end(&instrument, 0);
+        if(stop_requested()) break;
+
+        // Merge the fittest members the threads found while evaluating
+        phase_begin(&instrument, PHASE_MIN_COST);
+        topk_merge(&best, top, config.threads);
+        min_cost = best.e[0].cost;
+        phase_end(&instrument, 0);
+        // Finished, but past the deadline
+        if(stop_requested()) break;
+      }
+      complete = true;
+    }while(false);
+
+    if(complete){
+      archive_update(&archive, arena.cur, &best, generation_count);
+      stop_tracker_update(&tracker, generation_count, min_cost);
+
+      // Send the best tours to the job's other processes
+      if(multi_process && (generation_count + 1) % config.migration_interval == 0){
+        uint64_t t = trace_now();
+        process_emigrate(&transport, &arena, 0, config.population_size,
+                         (generation_count + 1) / config.migration_interval, migrant_buf);
+        trace_complete("Process emigrate", t, generation_count);
+      }
+      if(checkpointing && (generation_count + 1) % config.checkpoint_interval == 0){
+        // Only the snapshot copy is on this thread
+        phase_begin(&instrument, PHASE_CHECKPOINT);
+        checkpoint_save(&checkpointer, &arena, &archive, &tracker, generation_count + 1, instance);
+        phase_end(&instrument, 0);
+      }
+    }
+    generation_end(&instrument);
+    return complete;
+  }
+
+  bool step(){
+    if(done) return false;
+    if(islands || steady){
+      if(islands) run_islands();
+      else run_steady();
+      finish();
+      return false;
+    }
+    // A resumed run can already be at its generation limit
+    if(config.generations > 0 && generation_count >= config.generations){
+      stop_now(STOP_GENERATIONS);
+      finish();
+      return false;
+    }
+    if(!generation()){
+      finish();
+      return false;
+    }
+    if(!report(generation_count, min_cost, archive.cost[0], archive.generation[0], instrument.generation_ns)){
+      stop_now(STOP_CALLER);
+    }
+    // Stopping Conditions
+    bool over = stop_after_generation(&tracker, generation_count, arena.cost, arena.cost_valid);
+    generation_count++;
+    if(over){
+      finish();
+      return false;
+    }
+    return true;
+  }
+
+  float best_cost() const {
+    return archive.cost[0];
+  }
+
+  int best_generation() const {
+    return archive.generation[0];
+  }
+
+  void best_tour(int *tour) const {
+    const Gene *genes = archive_tour(&archive, 0);
+    for(int j = 0; j < cities; j++){
+      tour[j] = (int) genes[j];
+    }
+  }
+
+  bool process_info(int *rank, int *nprocs, const char **name) const {
+    if(!multi_process) return false;
+    *rank = transport.rank;
+    *nprocs = transport.nprocs;
+    *name = transport.name;
+    return true;
+  }
+
+  void print_timing(int generation){
+    instrument_print(&instrument, generation);
+  }
+
+  void print_scheduler() const {
+    scheduler_print(&sched);
+  }
+
+  void print_report() const {
+    instrument_report(&instrument);
+  }
+};
+
+// Solver for one gene type and the distance backend that suits the instance
+template<typename Gene>
+static GASolverImpl* solver_core_for(const TSPInstance *inst){
+  DistanceBackend backend = choose_distance_backend(inst);
+  switch(backend){
+    case TRIANGULAR: return new (std::nothrow) SolverCore<Gene, TriangularDistance>(inst->dimension, backend);
+    case QUANTIZED:  return new (std::nothrow) SolverCore<Gene, QuantizedDistance>(inst->dimension, backend);
+    case ON_THE_FLY: return new (std::nothrow) SolverCore<Gene, CoordDistance>(inst->dimension, backend);
+    default:         return new (std::nothrow) SolverCore<Gene, DenseDistance>(inst->dimension, backend);
+  }
+}
+
+// The narrowest gene type that can hold the instance's city indices (see GeneFor)
+static GASolverImpl* solver_core(const TSPInstance *inst){
+  if(inst->dimension <= 256) return solver_core_for<GeneFor<256>::type>(inst);
+  if(inst->dimension <= 65536) return solver_core_for<GeneFor<65536>::type>(inst);
+  return solver_core_for<GeneFor<65537>::type>(inst);
+}
+
+// Engine for inst, or NULL with *failure saying why it couldn't be set up
+static GASolverImpl* solver_engine(const TSPInstance *inst, const char **failure){
+  GASolverImpl *impl = solver_core(inst);
+  *failure = (impl == NULL) ? "out of memory for the solver" : impl->error;
+  if(*failure != NULL){
+    delete impl;
+    return NULL;
+  }
+  return impl;
+}
+
+static size_t gene_bytes_for(int cities){
+  if(cities <= 256) return sizeof(GeneFor<256>::type);
+  if(cities <= 65536) return sizeof(GeneFor<65536>::type);
+  return sizeof(GeneFor<65537>::type);
+}
+
+// ---- GASolver ----
+
+void GASolver::activate() const {
+  config = config_;
+  if(impl != NULL) num_cities = impl->cities;
+  stop_clock = impl ? &impl->clock : &stop_default;
+}
+
+GASolver::GASolver(const TSPInstance *inst, const GAConfig &params){
+  config_ = params;
+  callback = NULL;
+  user = NULL;
+  impl = NULL;
+  failure = validate(params);
+  if(failure != NULL) return;
+  if(config_.threads > config_.population_size){
+    config_.threads = config_.population_size;
+  }
+  activate();
+  num_cities = inst->dimension;
+  impl = solver_engine(inst, &failure);
+  if(impl == NULL) return;
+  stop_clock = &impl->clock;
+  impl->start(inst);
+  config_ = config; // A resumed run continues with the checkpoint's seed
+}
+
+GASolver::~GASolver(){
+  if(impl == NULL) return;
+  activate();
+  delete impl;
+  stop_clock = &stop_default;
+}
+
+void GASolver::set_callback(GACallback callback, void *user){
+  this->callback = callback;
+  this->user = user;
+  if(impl == NULL) return;
+  impl->callback = callback;
+  impl->user = user;
+}
+
+bool GASolver::step(){
+  if(impl == NULL) return false;
+  activate();
+  return impl->step();
+}
+
+int GASolver::run(){
+  while(step());
+  return generation();
+}
+
+void GASolver::reset(const TSPInstance *inst){
+  failure = validate(config_);
+  if(failure != NULL) return;
+  activate();
+  if(impl != NULL){
+    impl->finish(); // An unfinished run releases its instance
+    if(gene_bytes_for(inst->dimension) != impl->gene_bytes || choose_distance_backend(inst) != impl->backend
+       || inst->dimension > impl->capacity){
+      delete impl;
+      impl = NULL;
+      stop_clock = &stop_default;
+    }
+  }
+  num_cities = inst->dimension;
+  if(impl == NULL){
+    impl = solver_engine(inst, &failure);
+    if(impl == NULL) return;
+  }
+  stop_clock = &impl->clock;
+  impl->callback = callback;
+  impl->user = user;
+  impl->start(inst);
+  config_ = config;
+}
+
+// Without an engine (failure is set) the accessors report an empty run
+const char* GASolver::error() const { return impl ? impl->error : failure; }
+int GASolver::generation() const { return impl ? impl->generation_count : 0; }
+float GASolver::best_cost() const { return impl ? impl->best_cost() : INFINITY; }
+int GASolver::best_generation() const { return impl ? impl->best_generation() : -1; }
+int GASolver::cities() const { return impl ? impl->cities : 0; }
+const char* GASolver::stop_reason() const { return stop_reason_name(impl ? ::stop_reason(&impl->clock) : STOP_NONE); }
+double GASolver::elapsed_s() const { return !impl ? 0 : impl->done ? impl->elapsed : stop_elapsed_s(&impl->clock); }
+const GAConfig& GASolver::params() const { return config_; }
+DistanceBackend GASolver::distance_backend() const { return impl ? impl->backend : AUTO; }
+int GASolver::resumed_generation() const { return impl ? impl->resumed : -1; }
+long GASolver::duplicates() const { return impl ? impl->duplicates_total : 0; }
+long GASolver::steady_replaced() const { return impl ? impl->steady_replaced : 0; }
+long GASolver::steady_dropped() const { return impl ? impl->steady_dropped : 0; }
+int GASolver::checkpoints_written() const { return impl ? impl->checkpoints_written : 0; }
+int GASolver::checkpoints_skipped() const { return impl ? impl->checkpoints_skipped : 0; }
+
+void GASolver::best_tour(int *tour) const {
+  if(impl == NULL) return;
+  activate();
+  impl->best_tour(tour);
+}
+
+bool GASolver::process_info(int *rank, int *nprocs, const char **transport) const {
+  return impl ? impl->process_info(rank, nprocs, transport) : false;
+}
+
+void GASolver::print_timing(int generation){
+  if(impl == NULL) return;
+  activate();
+  impl->print_timing(generation);
+}
+
+void GASolver::print_scheduler() const {
+  if(impl == NULL) return;
+  activate();
+  impl->print_scheduler();
+}
+
+void GASolver::print_report() const {
+  if(impl == NULL) return;
+  activate();
+  impl->print_report();
+}
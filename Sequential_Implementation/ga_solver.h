@@ -0,0 +1,122 @@
+#include <stdint.h>
+#include "consts.cpp"
+#pragma once
+
+// Library interface of the GA (ga_solver.cpp).
+// A GASolver owns everything a run needs: the population arena, the thread
+// pool, the distance provider and the elite archive. It is built from an
+// instance and a GAConfig (start from the defaults in config and change
+// what you need), evaluates the initial population right away, and then
+// advances one generation per step() until a stopping policy (see
+// stopping.cpp) ends the run. After every generation it hands a GAGeneration
+// to the callback, if one is set; the solver doesn't print its progress.
+//
+// The solver never ends the process. Params validate() rejects, memory or
+// threads it can't get, and a checkpoint it can't resume from leave it
+// without a run and error() saying why. The only output of its own is a
+// line on why a file (an instance, a checkpoint) couldn't be read or
+// written, or why a multi-process job couldn't be joined.
+//
+// reset() starts a new run on another instance and keeps the threads and
+// the population buffers when they fit, so a caller solving many instances
+// pays for the allocations once.
+//
+// The engine reads its parameters, city count and stop state (see
+// stopping.cpp) from process-wide variables, which every GASolver call
+// points at its own copies. Solvers may interleave their calls, but only
+// one solver may be inside a call at a time.
+//
+// To build the library on linux:
+// g++ -O2 -c ga_solver.cpp -o ga_solver.o && ar rcs libga.a ga_solver.o
+// and link a client that includes only this header with -lga -lm -lpthread.
+// main.cpp is not such a client: it builds in one unit with ga_solver.cpp
+// and uses engine internals this header doesn't declare (config and its
+// option parser, the tracer, the tour writer, the cost kernel's name).
+
+struct TSPInstance;
+struct GASolverImpl;
+
+// Load a TSPLIB .tsp file; NULL (after printing why) if it can't be read
+TSPInstance* ga_load_instance(const char *path);
+// Instance of count cities at (x[i], y[i]) with EUC_2D distances; NULL when out of memory
+TSPInstance* ga_make_instance(const char *name, int count, const float *x, const float *y);
+void ga_free_instance(TSPInstance *inst);
+int ga_instance_cities(const TSPInstance *inst);
+const char* ga_instance_name(const TSPInstance *inst);
+
+// One completed generation
+typedef struct {
+  int generation;
+  float min_cost;          // Least cost in the generation
+  float best_cost;         // Best cost of the run so far
+  int best_generation;     // Generation that found it, -1 for the initial population
+  const int *best_tour;    // cities entries starting at city 0; valid during the callback only
+  int cities;
+  uint64_t generation_ns;  // Wall time of the generation; 0 for islands and the steady state,
+                           // which report their generations after one pass
+  double elapsed_s;        // Since the run started
+} GAGeneration;
+
+// Returning false stops the run after this generation
+typedef bool (*GACallback)(const GAGeneration *generation, void *user);
+
+// NULL when params can be run, otherwise why not (GASolver checks too)
+const char* validate(const GAConfig &params);
+
+class GASolver {
+public:
+  // Set up and evaluate the initial population (or resume from
+  // params.resume); check error() before stepping. Params that validate()
+  // rejects leave the solver without a run and error() saying why.
+  GASolver(const TSPInstance *inst, const GAConfig &params);
+  ~GASolver();
+
+  void set_callback(GACallback callback, void *user);
+
+  // Produce one generation (islands and the steady state run all of theirs
+  // in the first step). Returns false once the run is over.
+  bool step();
+  // Step until the run is over; returns the generations produced
+  int run();
+  // Start a new run on inst with the same parameters
+  void reset(const TSPInstance *inst);
+
+  // NULL, or why the run could not start
+  const char* error() const;
+  int generation() const;       // Generations completed
+  float best_cost() const;
+  int best_generation() const;  // -1 for the initial population
+  void best_tour(int *tour) const; // cities() entries
+  int cities() const;
+  const char* stop_reason() const;
+  double elapsed_s() const;
+  const GAConfig& params() const;
+  DistanceBackend distance_backend() const;
+
+  // Setup details and counters for a front end's report
+  int resumed_generation() const;  // -1 unless the run continued a checkpoint
+  // Rank, process count and transport of a multi-process job; false when single
+  bool process_info(int *rank, int *nprocs, const char **transport) const;
+  long duplicates() const;         // --dedup: duplicate tours mutated
+  long steady_replaced() const;    // STEADY: children that replaced a member
+  long steady_dropped() const;     // STEADY: children lost to a busy or improved slot
+  int checkpoints_written() const; // Valid once the run is over
+  int checkpoints_skipped() const;
+
+  // Print helpers for a command-line front end: the phase table since the
+  // last call (generation < 0 labels it as setup), the scheduler's chunk
+  // sizes, and the end-of-run timing report
+  void print_timing(int generation);
+  void print_scheduler() const;
+  void print_report() const;
+
+private:
+  GASolverImpl *impl;       // NULL when there is no run to make
+  const char *failure;      // Why there is no run
+  GAConfig config_;
+  GACallback callback;
+  void *user;
+  void activate() const;
+  GASolver(const GASolver&);
+  GASolver& operator=(const GASolver&);
+};
@@ -0,0 +1,298 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "consts.cpp"
+#include "population.cpp"
+#include "tracer.cpp"
+#pragma once
+
+// Per-phase, per-thread instrumentation (the --timing table and --report).
+// main brackets every GA phase with phase_begin()/phase_end(), which take
+// the wall time on a monotonic clock. Inside the phase each pool thread
+// measures its own busy time around the tasks it runs and, where the kernel
+// allows perf_event_open, its cycles, instructions, LLC misses and branch
+// misses. Counters are opened per thread by the thread itself, so they
+// count only that thread's work. Without --timing or --report the counters
+// stay closed and the probes only keep the busy time, which the chunk
+// scheduler tunes its chunk sizes from (see scheduler.cpp). Phases and
+// generations also go to the timeline tracer (tracer.cpp) when --trace is
+// on.
+//
+// From those, every phase gets:
+//   imbalance   slowest thread's busy time over the mean; 1.00 is balanced
+//   wait        share of the wall time the mean thread was not in a task
+//               (barriers and the serial work main does between tasks)
+//   IPC, MPKI   instructions per cycle, and LLC/branch misses per thousand
+//               instructions; phases above MEMORY_BOUND_MPKI LLC misses per
+//               thousand instructions are flagged as memory-bound
+
+// LLC misses per thousand instructions from which a phase counts as memory-bound
+#define MEMORY_BOUND_MPKI 5.0
+
+enum HwCounter { HW_CYCLES, HW_INSTRUCTIONS, HW_LLC_MISSES, HW_BRANCH_MISSES, NUM_HW_COUNTERS };
+
+enum Phase {
+  PHASE_INIT, PHASE_SELECTION, PHASE_CROSSOVER, PHASE_MUTATION, PHASE_LOCAL_SEARCH, PHASE_DEDUP,
+  PHASE_COST_UPDATE, PHASE_MIN_COST, PHASE_FUSED, PHASE_ISLANDS, PHASE_STEADY, PHASE_CHECKPOINT, NUM_PHASES
+};
+
+const char* phase_name(Phase phase){
+  switch(phase){
+    case PHASE_INIT: return "Initialization";
+    case PHASE_SELECTION: return "Selection";
+    case PHASE_CROSSOVER: return "Crossover";
+    case PHASE_MUTATION: return "Mutation";
+    case PHASE_LOCAL_SEARCH: return "Local search";
+    case PHASE_DEDUP: return "Dedup";
+    case PHASE_COST_UPDATE: return "Cost Update";
+    case PHASE_MIN_COST: return "Minimum Cost";
+    case PHASE_FUSED: return "Fused generation";
+    case PHASE_STEADY: return "Steady state";
+    case PHASE_CHECKPOINT: return "Checkpoint";
+    default: return "Islands";
+  }
+}
+
+typedef struct {
+  uint64_t ns;
+  uint64_t count[NUM_HW_COUNTERS];
+} Sample;
+
+// One pool thread's counters. Written only by its thread while a phase
+// runs; main reads it after the pool's barrier.
+typedef struct {
+  alignas(CACHE_LINE) int fd[NUM_HW_COUNTERS]; // -1 when the kernel refused the counter
+  bool opened;
+  Sample start; // At the start of the running task
+  Sample busy;  // Summed over the tasks of the current phase
+} ThreadProbe;
+
+// One phase of the current generation
+typedef struct {
+  bool ran;
+  uint64_t wall_ns;
+  uint64_t max_busy_ns, sum_busy_ns;
+  uint64_t count[NUM_HW_COUNTERS]; // Summed over the threads
+  bool counted[NUM_HW_COUNTERS];   // Every thread had the counter
+  long items;                      // Work items, for a throughput column
+} PhaseRow;
+
+typedef struct {
+  ThreadProbe *probes; // One per pool thread
+  int threads;
+  Phase phase;         // Running phase
+  int generation;      // Running generation, -1 outside the loop
+  uint64_t phase_start, generation_start;
+  PhaseRow rows[NUM_PHASES];
+  // Whole run, for the report
+  uint64_t total_ns[NUM_PHASES];
+  uint64_t generation_ns; // Last generation
+  uint64_t generation_total_ns;
+  int generations;
+} Instrument;
+
+static int perf_open(int counter){
+  static const uint64_t configs[NUM_HW_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+  };
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = configs[counter];
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  // This thread only, on whichever CPU it runs
+  return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void probe_sample(const ThreadProbe *p, Sample *s){
+  int k;
+  s->ns = monotonic_ns();
+  for(k = 0; k < NUM_HW_COUNTERS; k++){
+    uint64_t value = 0;
+    if(p->fd[k] >= 0 && read(p->fd[k], &value, sizeof(value)) != sizeof(value)){
+      value = 0;
+    }
+    s->count[k] = value;
+  }
+}
+
+// Called by the thread that runs a task, right before it
+void probe_begin(ThreadProbe *p){
+  int k;
+  if(!p->opened){
+    for(k = 0; k < NUM_HW_COUNTERS; k++){
+      p->fd[k] = perf_open(k);
+    }
+    p->opened = true;
+  }
+  probe_sample(p, &p->start);
+}
+
+// ... and right after it
+void probe_end(ThreadProbe *p){
+  Sample now;
+  int k;
+  probe_sample(p, &now);
+  p->busy.ns += now.ns - p->start.ns;
+  for(k = 0; k < NUM_HW_COUNTERS; k++){
+    p->busy.count[k] += now.count[k] - p->start.count[k];
+  }
+}
+
+// counters false leaves the hardware counters closed; the probes then only
+// time the tasks. False when out of memory.
+bool instrument_init(Instrument *in, int threads, bool counters){
+  int t, k;
+  memset(in, 0, sizeof(Instrument));
+  in->threads = threads;
+  in->generation = -1;
+  in->probes = (ThreadProbe *) aligned_alloc(CACHE_LINE, threads*sizeof(ThreadProbe));
+  if(in->probes == NULL) return false;
+  memset(in->probes, 0, threads*sizeof(ThreadProbe));
+  for(t = 0; t < threads; t++){
+    for(k = 0; k < NUM_HW_COUNTERS; k++){
+      in->probes[t].fd[k] = -1;
+    }
+    in->probes[t].opened = !counters;
+  }
+  return true;
+}
+
+// Forget the phases and totals of a previous run
+void instrument_restart(Instrument *in){
+  memset(in->rows, 0, sizeof(in->rows));
+  memset(in->total_ns, 0, sizeof(in->total_ns));
+  in->generation = -1;
+  in->generation_ns = in->generation_total_ns = 0;
+  in->generations = 0;
+}
+
+void instrument_free(Instrument *in){
+  int t, k;
+  for(t = 0; in->probes != NULL && t < in->threads; t++){
+    for(k = 0; k < NUM_HW_COUNTERS; k++){
+      if(in->probes[t].fd[k] >= 0) close(in->probes[t].fd[k]);
+    }
+  }
+  free(in->probes);
+}
+
+void phase_begin(Instrument *in, Phase phase){
+  int t;
+  in->phase = phase;
+  trace_phase(phase_name(phase), in->generation);
+  for(t = 0; t < in->threads; t++){
+    memset(&in->probes[t].busy, 0, sizeof(Sample));
+  }
+  in->phase_start = monotonic_ns();
+}
+
+// items > 0 adds a throughput column (parents for selection)
+void phase_end(Instrument *in, long items){
+  Phase phase = in->phase;
+  PhaseRow *row = &in->rows[phase];
+  int t, k;
+  row->wall_ns = monotonic_ns() - in->phase_start;
+  row->ran = true;
+  row->items = items;
+  row->max_busy_ns = row->sum_busy_ns = 0;
+  for(k = 0; k < NUM_HW_COUNTERS; k++){
+    row->count[k] = 0;
+    row->counted[k] = true;
+  }
+  for(t = 0; t < in->threads; t++){
+    const ThreadProbe *p = &in->probes[t];
+    if(p->busy.ns > row->max_busy_ns) row->max_busy_ns = p->busy.ns;
+    row->sum_busy_ns += p->busy.ns;
+    for(k = 0; k < NUM_HW_COUNTERS; k++){
+      row->count[k] += p->busy.count[k];
+      if(p->fd[k] < 0) row->counted[k] = false;
+    }
+  }
+  in->total_ns[phase] += row->wall_ns;
+  trace_complete(phase_name(phase), in->phase_start, in->generation);
+}
+
+void generation_begin(Instrument *in, int generation){
+  in->generation = generation;
+  in->generation_start = monotonic_ns();
+}
+
+void generation_end(Instrument *in){
+  in->generation_ns = monotonic_ns() - in->generation_start;
+  in->generation_total_ns += in->generation_ns;
+  in->generations++;
+  trace_complete("Generation", in->generation_start, in->generation);
+  in->generation = -1;
+}
+
+static void print_per_kilo(const PhaseRow *row, int counter){
+  if(row->counted[counter] && row->counted[HW_INSTRUCTIONS] && row->count[HW_INSTRUCTIONS] > 0){
+    printf(" %8.2f", 1000.0*row->count[counter] / row->count[HW_INSTRUCTIONS]);
+  }else{
+    printf(" %8s", "-");
+  }
+}
+
+// Table of the phases that ran since the last call; gen < 0 for phases
+// outside the generation loop
+void instrument_print(Instrument *in, int gen){
+  int phase;
+  char label[32];
+  if(gen >= 0) snprintf(label, sizeof(label), "Gen %d:", gen);
+  else snprintf(label, sizeof(label), "Setup:");
+  printf("%-22s %9s %9s %9s %6s %6s %6s %8s %8s\n", label,
+    "wall us", "max us", "mean us", "imbal", "wait", "IPC", "LLC MPKI", "br MPKI");
+  for(phase = 0; phase < NUM_PHASES; phase++){
+    PhaseRow *row = &in->rows[phase];
+    if(!row->ran) continue;
+    double mean_ns = (double) row->sum_busy_ns / in->threads;
+    printf("  %-20s %9.0f %9.0f %9.0f", phase_name((Phase) phase), row->wall_ns/1e3, row->max_busy_ns/1e3,
+      mean_ns/1e3);
+    printf(" %6.2f", mean_ns > 0 ? row->max_busy_ns / mean_ns : 1.0);
+    printf(" %5.1f%%", row->wall_ns > 0 ? 100.0*(1.0 - mean_ns / row->wall_ns) : 0.0);
+    if(row->counted[HW_CYCLES] && row->counted[HW_INSTRUCTIONS] && row->count[HW_CYCLES] > 0){
+      printf(" %6.2f", (double) row->count[HW_INSTRUCTIONS] / row->count[HW_CYCLES]);
+    }else{
+      printf(" %6s", "-");
+    }
+    print_per_kilo(row, HW_LLC_MISSES);
+    print_per_kilo(row, HW_BRANCH_MISSES);
+    if(row->counted[HW_LLC_MISSES] && row->counted[HW_INSTRUCTIONS] && row->count[HW_INSTRUCTIONS] > 0
+       && 1000.0*row->count[HW_LLC_MISSES] / row->count[HW_INSTRUCTIONS] >= MEMORY_BOUND_MPKI){
+      printf("  memory-bound");
+    }
+    if(row->items > 0){
+      // Items per us is millions per second
+      printf("  %.1f M parents/s", row->items / (row->wall_ns > 0 ? row->wall_ns/1e3 : 1.0));
+    }
+    printf("\n");
+    row->ran = false;
+  }
+  if(gen >= 0){
+    printf("  %-20s %9.0f\n", "Generation", in->generation_ns/1e3);
+  }
+}
+
+// Average wall time of each phase over the generations, in microseconds
+void instrument_report(const Instrument *in){
+  int n = in->generations > 0 ? in->generations : 1;
+  printf("\n TIMING REPORT: (values in us)\n");
+  printf("------------------------------\n");
+  printf("Averaged across %d generations\n", in->generations);
+  printf("------------------------------\n");
+  printf("SELECTION\tCROSSOVER\tMUTATION\tLOCAL_SEARCH\tCOST_UPDATE\tMINIMUM_COST\tGENERATION\n");
+  printf("%ld\t\t%ld\t\t%ld\t\t%ld\t\t%ld\t\t%ld\t\t%ld\n",
+    (long)(in->total_ns[PHASE_SELECTION]/n/1000), (long)(in->total_ns[PHASE_CROSSOVER]/n/1000),
+    (long)(in->total_ns[PHASE_MUTATION]/n/1000), (long)(in->total_ns[PHASE_LOCAL_SEARCH]/n/1000),
+    (long)(in->total_ns[PHASE_COST_UPDATE]/n/1000), (long)(in->total_ns[PHASE_MIN_COST]/n/1000),
+    (long)(in->generation_total_ns/n/1000));
+  printf("------------------------------\n");
+}
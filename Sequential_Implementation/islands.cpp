@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "consts.cpp"
+#include "population.cpp"
+#include "rng.cpp"
+#pragma once
+
+// Island model (the ISLANDS mode). Every worker thread owns its slice
+// of the population as an island and evolves it for the whole run without
+// synchronizing with the others. Every config.migration_interval generations an
+// island sends copies of its config.migration_size best members to its neighbours
+// in config.migration_topology; arriving migrants replace the island's worst
+// members when they are better.
+//
+// Migrants travel through one single-producer single-consumer ring per
+// directed edge of the topology. Only the sender moves a ring's tail and
+// only the receiver its head, so a push or pop is a copy plus one
+// release-store; nobody waits. A full ring drops the migrant.
+//
+// Islands run at their own pace, so which generation a migrant arrives in
+// depends on thread timing: with migration enabled, runs are no longer
+// bit-identical across config.threads or repeated runs.
+
+
+// Migrants a ring holds; a power of two
+#define MIGRANT_RING_SLOTS 16
+
+// The head and tail sit on their own cache lines so the sender and the
+// receiver never write to the same line
+template<typename Gene>
+struct MigrantRing {
+  alignas(CACHE_LINE) uint32_t head; // Next slot to read, written by the receiver
+  alignas(CACHE_LINE) uint32_t tail; // Next slot to write, written by the sender
+  alignas(CACHE_LINE) Gene *genes;   // MIGRANT_RING_SLOTS chromosomes
+  float cost[MIGRANT_RING_SLOTS];
+};
+
+// Who sends to whom. Also used between processes (see transport.cpp)
+typedef struct {
+  MigrationTopology topology;
+  int islands;
+  int rows, cols; // TORUS: islands laid out as a rows x cols grid
+  uint64_t seed;
+} IslandTopology;
+
+template<typename Gene>
+struct Migration {
+  MigrantRing<Gene> **rings; // rings[from*islands + to], NULL without that edge
+  IslandTopology topo;
+};
+
+const char* migration_topology_name(MigrationTopology topology){
+  switch(topology){
+    case TORUS: return "torus";
+    case RANDOM: return "random";
+    default: return "ring";
+  }
+}
+
+void topology_init(IslandTopology *m, int islands, MigrationTopology topology, uint64_t seed){
+  int k;
+  m->islands = islands;
+  m->topology = topology;
+  m->seed = seed;
+  // Most square grid: the largest divisor of islands up to its square root
+  m->rows = 1;
+  for(k = 1; k*k <= islands; k++){
+    if(islands % k == 0) m->rows = k;
+  }
+  m->cols = islands / m->rows;
+}
+
+// Islands that `island` sends to in migration number `epoch`.
+// Returns how many were written to targets (at most 4)
+int migration_targets(const IslandTopology *m, int island, int epoch, int *targets){
+  int count = 0, k;
+  if(m->islands < 2) return 0;
+  if(m->topology == RANDOM){
+    // A fresh random peer every epoch
+    Rng rng = rng_member(rng_key(m->seed, epoch, RNG_MIGRATION), island);
+    int peer = rng_bounded(&rng, m->islands - 1);
+    targets[0] = (peer >= island) ? peer + 1 : peer;
+    return 1;
+  }
+  if(m->topology == TORUS){
+    int row = island / m->cols, col = island % m->cols;
+    int candidates[4] = {
+      row*m->cols + (col + 1) % m->cols,
+      row*m->cols + (col + m->cols - 1) % m->cols,
+      ((row + 1) % m->rows)*m->cols + col,
+      ((row + m->rows - 1) % m->rows)*m->cols + col
+    };
+    // Small grids wrap onto the same neighbour (or the island itself)
+    for(k = 0; k < 4; k++){
+      int c = candidates[k], seen = (c == island), j;
+      for(j = 0; j < count; j++){
+        if(targets[j] == c) seen = 1;
+      }
+      if(!seen) targets[count++] = c;
+    }
+    return count;
+  }
+  targets[0] = (island + 1) % m->islands;
+  return 1;
+}
+
+// NULL when out of memory
+template<typename Gene>
+static MigrantRing<Gene>* ring_alloc(){
+  MigrantRing<Gene> *ring = (MigrantRing<Gene> *) aligned_alloc(CACHE_LINE, sizeof(MigrantRing<Gene>));
+  if(ring == NULL) return NULL;
+  memset(ring, 0, sizeof(MigrantRing<Gene>));
+  ring->genes = (Gene *) malloc((size_t)MIGRANT_RING_SLOTS*num_cities*sizeof(Gene));
+  if(ring->genes == NULL){ free(ring); return NULL; }
+  return ring;
+}
+
+// Allocate a ring for every edge the topology can use. False when out of
+// memory; migration_free() releases what was allocated.
+template<typename Gene>
+bool migration_init(Migration<Gene> *m, int islands, MigrationTopology topology, uint64_t seed){
+  int from, to, k;
+  topology_init(&m->topo, islands, topology, seed);
+  m->rings = (MigrantRing<Gene> **) calloc((size_t)islands*islands, sizeof(MigrantRing<Gene> *));
+  if(m->rings == NULL) return false;
+  for(from = 0; from < islands; from++){
+    if(topology == RANDOM){
+      // Any other island can be picked
+      for(to = 0; to < islands; to++){
+        if(to == from) continue;
+        m->rings[from*islands + to] = ring_alloc<Gene>();
+        if(m->rings[from*islands + to] == NULL) return false;
+      }
+      continue;
+    }
+    int targets[4];
+    int count = migration_targets(&m->topo, from, 0, targets);
+    for(k = 0; k < count; k++){
+      m->rings[from*islands + targets[k]] = ring_alloc<Gene>();
+      if(m->rings[from*islands + targets[k]] == NULL) return false;
+    }
+  }
+  return true;
+}
+
+template<typename Gene>
+void migration_free(Migration<Gene> *m){
+  int k;
+  for(k = 0; m->rings != NULL && k < m->topo.islands*m->topo.islands; k++){
+    if(m->rings[k] != NULL){
+      free(m->rings[k]->genes);
+      free(m->rings[k]);
+    }
+  }
+  free(m->rings);
+}
+
+// Sender side: copy a chromosome into the ring; false when the ring is full
+template<typename Gene>
+bool ring_push(MigrantRing<Gene> *ring, const Gene *genes, float cost){
+  uint32_t tail = ring->tail;
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if(tail - head == MIGRANT_RING_SLOTS) return false;
+  uint32_t slot = tail & (MIGRANT_RING_SLOTS - 1);
+  memcpy(ring->genes + (size_t)slot*num_cities, genes, num_cities*sizeof(Gene));
+  ring->cost[slot] = cost;
+  // Publish the slot only after its contents are written
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// Receiver side: the oldest migrant's slot, or NULL when the ring is empty.
+// The slot stays valid until ring_release().
+template<typename Gene>
+const Gene* ring_peek(MigrantRing<Gene> *ring, float *cost){
+  uint32_t head = ring->head;
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if(head == tail) return NULL;
+  uint32_t slot = head & (MIGRANT_RING_SLOTS - 1);
+  *cost = ring->cost[slot];
+  return ring->genes + (size_t)slot*num_cities;
+}
+
+template<typename Gene>
+void ring_release(MigrantRing<Gene> *ring){
+  __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+// Indices of the k cheapest members of [start, end), cheapest first
+int island_elites(const float *cost, int start, int end, int *best, int k){
+  int count = 0, i, j;
+  for(i = start; i != end; i++){
+    if(count == k && cost[i] >= cost[best[k-1]]) continue;
+    // Insertion into the sorted list of the best so far
+    j = (count < k) ? count++ : k - 1;
+    while(j > 0 && cost[best[j-1]] > cost[i]){
+      best[j] = best[j-1];
+      j--;
+    }
+    best[j] = i;
+  }
+  return count;
+}
+
+// Most expensive member of [start, end)
+int island_worst(const float *cost, int start, int end){
+  int i, worst = start;
+  for(i = start + 1; i < end; i++){
+    if(cost[i] > cost[worst]) worst = i;
+  }
+  return worst;
+}
+
+// Send the island's elites to its neighbours for migration number epoch
+template<typename Gene>
+void island_emigrate(Migration<Gene> *m, int island, const PopArena<Gene> *arena,
+                     int start, int end, int epoch){
+  int best[MIGRANT_RING_SLOTS], targets[4]; // migration_size is at most MIGRANT_RING_SLOTS
+  int count = island_elites(arena->cost, start, end, best, config.migration_size);
+  int num_targets = migration_targets(&m->topo, island, epoch, targets);
+  int t, k;
+  for(t = 0; t < num_targets; t++){
+    MigrantRing<Gene> *ring = m->rings[island*m->topo.islands + targets[t]];
+    for(k = 0; k < count; k++){
+      ring_push(ring, chromosome(arena->cur, best[k]), arena->cost[best[k]]);
+    }
+  }
+}
+
+// Take in every migrant waiting for the island; each one replaces the
+// island's worst member if it is cheaper. Returns how many were accepted.
+template<typename Gene>
+int island_immigrate(Migration<Gene> *m, int island, PopArena<Gene> *arena, int start, int end){
+  int from, accepted = 0;
+  for(from = 0; from < m->topo.islands; from++){
+    MigrantRing<Gene> *ring = m->rings[from*m->topo.islands + island];
+    if(ring == NULL) continue;
+    const Gene *genes;
+    float cost;
+    while((genes = ring_peek(ring, &cost)) != NULL){
+      int worst = island_worst(arena->cost, start, end);
+      if(cost < arena->cost[worst]){
+        memcpy(chromosome(arena->cur, worst), genes, num_cities*sizeof(Gene));
+        arena->cost[worst] = cost;
+        arena->cost_valid[worst] = 1;
+        accepted++;
+      }
+      ring_release(ring);
+    }
+  }
+  return accepted;
+}
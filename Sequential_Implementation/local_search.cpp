@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "consts.cpp"
+#include "population.cpp"
+#include "tsplib.cpp"
+#include "distance.cpp"
+#include "mutation_ops.cpp"
+#pragma once
+
+// Memetic local search. After mutation, the members chosen by
+// config.local_search are driven to a local optimum of
+// 2-opt and Or-opt moves. Moves are only tried towards each city's
+// config.neighbor_k nearest cities, and a don't-look bit per city skips cities
+// whose neighbourhood yielded nothing since their edges last changed, so a
+// pass costs about O(num_cities * config.neighbor_k) instead of O(num_cities^2).
+// City 0 stays at position 0 and every move reports its delta, so members
+// keep valid costs.
+
+
+// Smallest improvement a move must make; guards against cycling on
+// rounding noise
+#define LS_EPSILON 1e-4f
+
+// near[a*k + r] is the r-th nearest city to a
+typedef struct {
+  int *near;
+  int k;
+} NeighborLists;
+
+// Per-thread working memory of local_search()
+typedef struct {
+  int *pos;        // Position of every city in the chromosome
+  int *queue;      // Cities whose don't-look bit is off, in FIFO order
+  uint8_t *active; // 1 while a city is queued (its don't-look bit is off)
+} LocalSearchScratch;
+
+// Keep the k cities of cand[0, count) closest to a
+template<typename Dist>
+static void keep_nearest(const Dist &dist, int a, int *cand, int count, int k, int *out){
+  std::partial_sort(cand, cand + k, cand + count, [&](int x, int y){
+    float dx = dist(a, x), dy = dist(a, y);
+    return (dx < dy) || (dx == dy && x < y);
+  });
+  memcpy(out, cand, k*sizeof(int));
+}
+
+// Candidate lists for every city. Coordinate instances bucket the cities
+// into a uniform grid of about two cities per cell and search rings of
+// cells around each city until k candidates are found, plus one more ring
+// for the ones just outside; explicit instances scan the whole row.
+// False when out of memory; free_neighbors() is safe to call either way.
+template<typename Dist>
+bool build_neighbors(NeighborLists *nb, const TSPInstance *inst, const Dist &dist, int k){
+  int n = inst->dimension;
+  int a, c;
+  if(k > n - 1) k = n - 1;
+  nb->k = k;
+  nb->near = (int *) malloc((size_t)n*(k > 0 ? k : 1)*sizeof(int));
+  int *cand = (int *) malloc(n*sizeof(int));
+  if(nb->near == NULL || cand == NULL){ free(cand); return false; }
+  if(k <= 0){ free(cand); return true; }
+
+  if(inst->type == EXPLICIT){
+    for(a = 0; a < n; a++){
+      int count = 0;
+      for(c = 0; c < n; c++){
+        if(c != a) cand[count++] = c;
+      }
+      keep_nearest(dist, a, cand, count, k, nb->near + (size_t)a*k);
+    }
+    free(cand);
+    return true;
+  }
+
+  float min_x = inst->x[0], max_x = inst->x[0], min_y = inst->y[0], max_y = inst->y[0];
+  for(a = 1; a < n; a++){
+    min_x = fminf(min_x, inst->x[a]); max_x = fmaxf(max_x, inst->x[a]);
+    min_y = fminf(min_y, inst->y[a]); max_y = fmaxf(max_y, inst->y[a]);
+  }
+  int g = (int) sqrt(n / 2.0);
+  if(g < 1) g = 1;
+  float cell_w = (max_x - min_x) / g + 1e-6f, cell_h = (max_y - min_y) / g + 1e-6f;
+  int *cell_of = (int *) malloc(n*sizeof(int));
+  int *cell_start = (int *) calloc((size_t)g*g + 1, sizeof(int));
+  int *cell_items = (int *) malloc(n*sizeof(int));
+  int *fill = (int *) malloc((size_t)g*g*sizeof(int));
+  if(cell_of == NULL || cell_start == NULL || cell_items == NULL || fill == NULL){
+    free(cell_of);
+    free(cell_start);
+    free(cell_items);
+    free(fill);
+    free(cand);
+    return false;
+  }
+  // Counting sort of the cities by cell
+  for(a = 0; a < n; a++){
+    int cx = std::min(g - 1, (int)((inst->x[a] - min_x) / cell_w));
+    int cy = std::min(g - 1, (int)((inst->y[a] - min_y) / cell_h));
+    cell_of[a] = cy*g + cx;
+    cell_start[cell_of[a] + 1]++;
+  }
+  for(c = 0; c < g*g; c++){
+    cell_start[c + 1] += cell_start[c];
+  }
+  memcpy(fill, cell_start, (size_t)g*g*sizeof(int));
+  for(a = 0; a < n; a++){
+    cell_items[fill[cell_of[a]]++] = a;
+  }
+  free(fill);
+
+  for(a = 0; a < n; a++){
+    int cx = cell_of[a] % g, cy = cell_of[a] / g;
+    int count = 0, r, extra = -1;
+    for(r = 0; r <= g && (extra < 0 || r <= extra); r++){
+      int x, y;
+      for(y = cy - r; y <= cy + r; y++){
+        if(y < 0 || y >= g) continue;
+        // Interior rows of the ring only have their two end cells
+        int step = (y == cy - r || y == cy + r) ? 1 : 2*r;
+        for(x = cx - r; x <= cx + r; x += (step > 0 ? step : 1)){
+          if(x < 0 || x >= g) continue;
+          int cell = y*g + x, item;
+          for(item = cell_start[cell]; item < cell_start[cell + 1]; item++){
+            if(cell_items[item] != a) cand[count++] = cell_items[item];
+          }
+        }
+      }
+      if(extra < 0 && count >= k) extra = r + 1;
+    }
+    keep_nearest(dist, a, cand, count, k, nb->near + (size_t)a*k);
+  }
+  free(cell_of);
+  free(cell_start);
+  free(cell_items);
+  free(cand);
+  return true;
+}
+
+void free_neighbors(NeighborLists *nb){ free(nb->near); nb->near = NULL; }
+
+// False when out of memory; ls_scratch_free() releases what was allocated
+bool ls_scratch_init(LocalSearchScratch *s){
+  s->pos = (int *) malloc(num_cities*sizeof(int));
+  s->queue = (int *) malloc(num_cities*sizeof(int));
+  s->active = (uint8_t *) malloc(num_cities);
+  return s->pos != NULL && s->queue != NULL && s->active != NULL;
+}
+
+void ls_scratch_free(LocalSearchScratch *s){
+  free(s->pos);
+  free(s->queue);
+  free(s->active);
+}
+
+// FIFO of cities to look at; each city is queued at most once
+typedef struct {
+  LocalSearchScratch *s;
+  int head, count;
+} LsQueue;
+
+static inline void ls_push(LsQueue *q, int city){
+  if(q->s->active[city]) return;
+  q->s->active[city] = 1;
+  int tail = q->head + q->count;
+  q->s->queue[tail >= num_cities ? tail - num_cities : tail] = city;
+  q->count++;
+}
+
+static inline int ls_pop(LsQueue *q){
+  int city = q->s->queue[q->head];
+  q->head = (q->head + 1 == num_cities) ? 0 : q->head + 1;
+  q->count--;
+  q->s->active[city] = 0;
+  return city;
+}
+
+// Apply the reversal of [p, q] if it improves the path by more than
+// LS_EPSILON; the cities at its ends get their don't-look bits cleared
+template<typename Gene, typename Dist>
+static bool ls_reverse(const Dist &dist, Gene *genes, int p, int q, LsQueue *queue, float *total){
+  if(p > q){ int t = p; p = q; q = t; }
+  if(p < 1 || p == q) return false;
+  float delta = two_opt_delta(dist, genes, p, q);
+  if(delta > -LS_EPSILON) return false;
+  ls_push(queue, genes[p-1]);
+  ls_push(queue, genes[p]);
+  ls_push(queue, genes[q]);
+  if(q + 1 < num_cities) ls_push(queue, genes[q+1]);
+  *total += two_opt_mutation(dist, genes, p, q);
+  int t;
+  for(t = p; t <= q; t++){
+    queue->s->pos[genes[t]] = t;
+  }
+  return true;
+}
+
+// Apply the move of the len genes at p to after position k if it improves
+// the path by more than LS_EPSILON
+template<typename Gene, typename Dist>
+static bool ls_move(const Dist &dist, Gene *genes, int p, int len, int k, LsQueue *queue, float *total){
+  int last = p + len - 1;
+  if(p < 1 || last >= num_cities || k < 0 || k >= num_cities || (k >= p - 1 && k <= last)) return false;
+  float delta = or_opt_delta(dist, genes, p, len, k);
+  if(delta > -LS_EPSILON) return false;
+  ls_push(queue, genes[p-1]);
+  ls_push(queue, genes[p]);
+  ls_push(queue, genes[last]);
+  if(last + 1 < num_cities) ls_push(queue, genes[last+1]);
+  ls_push(queue, genes[k]);
+  if(k + 1 < num_cities) ls_push(queue, genes[k+1]);
+  *total += or_opt_mutation(dist, genes, p, len, k);
+  int lo = std::min(p, k + 1), hi = std::max(last, k), t;
+  for(t = lo; t <= hi; t++){
+    queue->s->pos[genes[t]] = t;
+  }
+  return true;
+}
+
+// Try to join city a to one of its near cities with a 2-opt move
+template<typename Gene, typename Dist>
+static bool ls_two_opt(const Dist &dist, const NeighborLists &nb, Gene *genes, int a, LsQueue *queue, float *total){
+  const int *pos = queue->s->pos;
+  int i = pos[a], r;
+  // An improving move must add an edge shorter than the one it replaces
+  float succ_edge = (i + 1 < num_cities) ? dist(a, genes[i+1]) : 0.0f;
+  float pred_edge = (i > 0) ? dist(genes[i-1], a) : 0.0f;
+  for(r = 0; r < nb.k; r++){
+    int b = nb.near[(size_t)a*nb.k + r];
+    float d = dist(a, b);
+    if(d >= succ_edge && d >= pred_edge) break;
+    int j = pos[b];
+    // Replace (a, succ a): b becomes a's successor
+    if(d < succ_edge){
+      if(j > i + 1 && ls_reverse(dist, genes, i + 1, j, queue, total)) return true;
+      if(j < i && ls_reverse(dist, genes, j + 1, i, queue, total)) return true;
+    }
+    // Replace (pred a, a): b becomes a's predecessor
+    if(d < pred_edge){
+      if(j > i && ls_reverse(dist, genes, i, j - 1, queue, total)) return true;
+      if(j < i - 1 && ls_reverse(dist, genes, j, i - 1, queue, total)) return true;
+    }
+  }
+  return false;
+}
+
+// Try to move a segment of up to three cities that starts or ends at a
+// next to one of a's near cities
+template<typename Gene, typename Dist>
+static bool ls_or_opt(const Dist &dist, const NeighborLists &nb, Gene *genes, int a, LsQueue *queue, float *total){
+  const int *pos = queue->s->pos;
+  int i = pos[a], r, len;
+  for(r = 0; r < nb.k; r++){
+    int b = nb.near[(size_t)a*nb.k + r];
+    int j = pos[b];
+    for(len = 1; len <= 3; len++){
+      // Segment starting at a, placed after b
+      if(ls_move(dist, genes, i, len, j, queue, total)) return true;
+      // Segment ending at a, placed before b
+      if(ls_move(dist, genes, i - len + 1, len, j - 1, queue, total)) return true;
+    }
+  }
+  return false;
+}
+
+// Improve one chromosome to a 2-opt/Or-opt local optimum over the neighbor
+// lists and return the change in its length
+template<typename Gene, typename Dist>
+float local_search(const Dist &dist, const NeighborLists &nb, Gene *genes, LocalSearchScratch *s){
+  int i;
+  float total = 0.0f;
+  if(nb.k <= 0) return 0.0f;
+  LsQueue queue = { s, 0, 0 };
+  memset(s->active, 0, num_cities);
+  for(i = 0; i < num_cities; i++){
+    s->pos[genes[i]] = i;
+  }
+  for(i = 0; i < num_cities; i++){
+    ls_push(&queue, genes[i]);
+  }
+  while(queue.count > 0){
+    int a = ls_pop(&queue);
+    if(ls_two_opt(dist, nb, genes, a, &queue, &total) || ls_or_opt(dist, nb, genes, a, &queue, &total)){
+      ls_push(&queue, a); // a may have more to give
+    }
+  }
+  return total;
+}
+
+// Which members are improved: those cheaper than cost, and those equal to
+// it up to index last_tie. A converged population has thousands of members
+// tied at the percentile, so the ties are cut off by index; that keeps the
+// choice independent of how the population is sliced.
+typedef struct {
+  float cost;
+  int last_tie;
+} LsCutoff;
+
+static inline bool ls_selected(LsCutoff cutoff, float cost, int i){
+  return cost < cutoff.cost || (cost == cutoff.cost && i <= cutoff.last_tie);
+}
+
+// The config.local_search_elite percent cheapest members for ELITE_MEMBERS,
+// everything for ALL_MEMBERS. scratch holds config.population_size floats.
+LsCutoff local_search_cutoff(const float *cost, float *scratch){
+  LsCutoff cutoff = { INFINITY, config.population_size };
+  if(config.local_search == ALL_MEMBERS) return cutoff;
+  int m = (int)((long)config.population_size*config.local_search_elite / 100);
+  int i, below = 0;
+  if(m < 1) m = 1;
+  memcpy(scratch, cost, config.population_size*sizeof(float));
+  std::nth_element(scratch, scratch + m - 1, scratch + config.population_size);
+  cutoff.cost = scratch[m - 1];
+  for(i = 0; i < config.population_size; i++){
+    if(cost[i] < cutoff.cost) below++;
+  }
+  // Take the first m - below tied members
+  int ties = m - below;
+  for(i = 0; i < config.population_size && ties > 0; i++){
+    if(cost[i] == cutoff.cost){
+      cutoff.last_tie = i;
+      ties--;
+    }
+  }
+  return cutoff;
+}
+
+// Local search on the members of [start, end) picked by cutoff (whose
+// costs must be valid). The costs take the improvements as deltas; the
+// members it changed are rehashed when hashes isn't NULL. scratch is the
+// calling thread's, set up once with ls_scratch_init().
+template<typename Gene, typename Dist>
+void local_search_range(Gene *pop, float *cost, uint8_t *cost_valid, uint64_t *hashes, const Dist &dist,
+                        const NeighborLists &nb, int start, int end, LsCutoff cutoff, LocalSearchScratch *scratch){
+  int i;
+  for(i = start; i != end; i++){
+    if(!cost_valid[i] || !ls_selected(cutoff, cost[i], i)) continue;
+    float delta = local_search(dist, nb, chromosome(pop, i), scratch);
+    cost[i] += delta;
+    if(hashes && delta != 0.0f){
+      hashes[i] = tour_hash(chromosome(pop, i));
+    }
+    #ifdef VERIFY_DELTAS
+      verify_delta(dist, chromosome(pop, i), cost[i], "local search", i);
+    #endif
+  }
+}
@@ -2,428 +2,147 @@
 #include <stdlib.h>
 #include <iostream>
 #include <math.h>
-#include "consts.cpp"
-
-#ifdef EMBEDDED
-  #include <sys/time.h>
-  #include <pthread.h>
-#else
-  #include <time.h>
-#endif
-
-#ifdef PARALLEL
-  #include "GA_functions_parallel.cpp"
-#else
-  #include "GA_functions.cpp"
-#endif
-
+#include <pthread.h>
+#include "config.cpp"
+#include "ga_solver.cpp"
+
+// Command-line front end of the GA library (see ga_solver.h): parses the
+// options into config, runs a GASolver on each instance and prints what
+// the solver reports.
+//
 // To run on linux:
 // g++ main.cpp -o GA -lm -lpthread
+// ./GA [options] [instance.tsp ...]    (defaults to instances/berlin52.tsp, see ./GA --help)
+// ./GA --threads 4 --mode fused instances/kroA100.tsp
+// Several cooperating processes (see transport.cpp):
+// GA_NPROCS=2 GA_RANK=0 ./GA & GA_NPROCS=2 GA_RANK=1 ./GA
+
+// Print every finished generation, and its phase table with --timing
+static bool print_generation(const GAGeneration *g, void *user){
+  GASolver *solver = (GASolver *) user;
+  printf("Generation %d's minimum cost: \t %.0f\n", g->generation, g->min_cost);
+  if(config.timing && g->generation_ns > 0){
+    solver->print_timing(g->generation);
+  }
+  return true;
+}
+
+// Setup details, printed once the solver has evaluated the initial population
+static void print_setup(const GASolver *solver){
+  int rank, nprocs;
+  const char *transport;
+  if(!config.verbose) return;
+  DistanceBackend backend = solver->distance_backend();
+  printf("Distance backend: %s, cost kernel: %s, selection: %s, mode: %s, %d thread(s)\n",
+    distance_backend_name(backend), backend == DENSE ? cost_isa_name(cost_isa) : "scalar",
+    selection_method_name(config.selection), generation_mode_name(config.mode), config.threads);
+  if(solver->process_info(&rank, &nprocs, &transport)){
+    printf("Process %d of %d, %s transport\n", rank, nprocs, transport);
+  }
+}
+
+// Summary of a finished run
+static void print_result(const GASolver *solver, const char *name){
+  int i, cities = solver->cities();
+  int *tour = (int*)malloc(cities*sizeof(int));
+  solver->best_tour(tour);
+  if(config.verbose){
+    printf("Stopped after %d generation(s) in %.2f s (%s), best cost %.0f ", solver->generation(),
+      solver->elapsed_s(), solver->stop_reason(), solver->best_cost());
+    if(solver->best_generation() >= 0) printf("from generation %d\n", solver->best_generation());
+    else printf("from the initial population\n");
+    printf("Best tour:");
+    for(i=0; i<cities; i++){
+      printf(" %d", tour[i]);
+    }
+    printf("\n");
+    if(config.dedup){
+      printf("%ld duplicate tour(s) mutated\n", solver->duplicates());
+    }
+    if(config.mode == STEADY){
+      printf("%ld children replaced a member, %ld dropped on a busy or improved slot\n",
+        solver->steady_replaced(), solver->steady_dropped());
+    }else if(config.mode != ISLANDS){
+      solver->print_scheduler();
+    }
+  }
 
-int main(int argc, char **argv){
-  // -------------Initialization-------------
-
-  #ifdef TIMING
-  #ifdef EMBEDDED
-  // Timing Variables:
-  struct timeval start, end, startgen, endgen;
-  long t_us;
-  long sel_avg_us = 0, cross_avg_us = 0, mut_avg_us = 0,
-    fit_avg_us = 0, min_avg_us = 0, gen_avg_us = 0;
-  gettimeofday(&start, NULL);
-  #else
-  float milliseconds;
-
-  clock_t start, end, startgen, endgen;
-
-  start = clock();
-  #endif
-  #endif
-
-  #ifdef PARALLEL
-  int status;
-    pthread_t *thread;
-    TH_args *thread_args;
-    thread_args = (TH_args *)calloc(NUM_THREADS, sizeof(TH_args));
-    thread = (pthread_t *) malloc(NUM_THREADS*sizeof(pthread_t));
-  #endif
+  if(config.tour != NULL){
+    write_tsplib_tour(config.tour, name, tour, cities, solver->best_cost());
+  }
+  if(config.report){
+    solver->print_report();
+  }
+  if(config.checkpoint != NULL && config.verbose){
+    printf("%d checkpoint(s) written to %s, %d skipped while the writer was busy\n",
+      solver->checkpoints_written(), config.checkpoint, solver->checkpoints_skipped());
+  }
+  free(tour);
+}
 
-  // Variable Initialization:
-  int **pop; // The population
-  // Allocate memory for each member of the populations chromosome
-  pop = (int**) calloc(POPULATION_SIZE, sizeof(int*));
-  int i, j;
-  for(i = 0; i<POPULATION_SIZE; i++){
-    // Allocate memory for each chromosome's genes
-    pop[i] = (int*) calloc(NUM_CITIES, sizeof(int));
+int main(int argc, char **argv){
+  const char *default_instance = "instances/berlin52.tsp";
+  int instances = parse_args(argc, argv);
+  if(instances < 0){
+    return instances == ARGS_HELP ? 0 : -1;
   }
-  float *cost; // Each chromosomes cost
-  cost = (float*)calloc(POPULATION_SIZE, sizeof(float));
-  int *parents; // Selected parents to create next generation
-  parents = (int*)calloc(POPULATION_SIZE*2, sizeof(int));
-  float **cost_table;
-  cost_table = (float**)calloc(NUM_CITIES,sizeof(float*));
-  for(i = 0; i<NUM_CITIES; i++){
-    cost_table[i] = (float*)calloc(NUM_CITIES,sizeof(float));
+  if(config.trace != NULL){
+    trace_init(config.trace);
+  }
+  if(instances == 0){
+    // No instance given, solve the default one
+    argv[0] = (char *) default_instance;
+    instances = 1;
   }
-  float *min;
-  min = (float*)calloc(NUM_THREADS,sizeof(float));
 
-  #ifdef PARALLEL
-    // The range of the population a single thread should handle, rounded up
-    int thread_range = (int)(((float)POPULATION_SIZE / (float)NUM_THREADS) + 0.5); 
-    // Initializing thread arguments
-    for(i=0; i < NUM_THREADS; i++){
-      thread_args[i].pop = pop;
-      thread_args[i].cost = cost;
-      thread_args[i].parents = parents;
-      thread_args[i].cost_table = cost_table;
-      thread_args[i].start = (i * thread_range);
-      thread_args[i].end = ((i+1)* thread_range);
-      if (thread_args[i].end > POPULATION_SIZE){
-        thread_args[i].end = POPULATION_SIZE;
-      }
-      thread_args[i].seed = rand(); // Not certain this is neccesary, rand_r seems to just need a unique int address, not value
-      thread_args[i].min = min;
-      thread_args[i].thrdIdx = i;
+  // Solve each instance in turn; one solver keeps its threads and buffers
+  // for the next instance when they fit
+  GASolver *solver = NULL;
+  for(int k = 0; k < instances; k++){
+    TSPInstance *inst = ga_load_instance(argv[k]);
+    if(inst == NULL){
+      return -1;
     }
-  #endif
-
-  // Build Cost Table
-  build_cost_table(cost_table);
-
-  // Initialize Population
-  initialize_population(pop);
-  #ifdef DEBUG
-    for(i=0; i<POPULATION_SIZE; i++){
-      for(j=0; j<NUM_CITIES; j++){
-        if(pop[i][j] < 0 || pop[i][j] >= NUM_CITIES){
-          printf("Population member %d has invalid city %d at index %d\n", i, pop[i][j], j);
-        }
-      }
+    if(config.verbose){
+      printf("Instance %s: %d cities\n", ga_instance_name(inst), ga_instance_cities(inst));
     }
-  #endif
-
-  // Cost Evaluation
-  #ifdef PARALLEL
-    // Launch threads
-    for(i=0; i<NUM_THREADS; i++){
-      status = pthread_create(&thread[i], NULL, cost_update, (void *) &thread_args[i]);
-      if ( status != 0 ) { perror("(main) Can't create thread"); free(thread); exit(-1); }
+    if(solver == NULL){
+      solver = new GASolver(inst, config);
+    }else{
+      solver->reset(inst);
     }
-    // Wait for all threads to complete
-    for(i=0; i<NUM_THREADS; i++){
-      pthread_join(thread[i], NULL);
+    solver->set_callback(print_generation, solver);
+    if(solver->error() != NULL){
+      printf("Can't solve %s: %s\n", ga_instance_name(inst), solver->error());
+      return -1;
     }
-  #else
-    cost_update(pop, cost, cost_table);
-  #endif
-
-  // Find least cost
-  #ifdef PARALLEL
-    // Launch threads
-    for(i=0; i<NUM_THREADS; i++){
-      status = pthread_create(&thread[i], NULL, findleastcost, (void *) &thread_args[i]);
-      if ( status != 0 ) { perror("(main) Can't create thread"); free(thread); exit(-1); }
+    print_setup(solver);
+    if(config.verbose && solver->resumed_generation() >= 0){
+      printf("Resumed from %s at generation %d\n", config.resume, solver->resumed_generation());
     }
-    // Wait for all threads to complete
-    for(i=0; i<NUM_THREADS; i++){
-      pthread_join(thread[i], NULL);
+    if(config.timing){
+      solver->print_timing(-1);
     }
-    // Find minimum from outputs
-    float min_cost = min[0];
-    for(i=1; i<NUM_THREADS; i++){
-      if(min[i] < min_cost){
-        min_cost = min[i];
+    if(config.verbose){
+      printf("Initial population least cost: %.0f\n", solver->best_cost());
+      if(config.mode == ISLANDS){
+        printf("%d islands of %d, %s migration of %d every %d generations\n", config.threads,
+          (config.population_size + config.threads - 1) / config.threads,
+          migration_topology_name(config.migration_topology), config.migration_size, config.migration_interval);
+      }else if(config.mode == STEADY){
+        printf("Steady state on %d thread(s), %d children per generation\n", config.threads, config.population_size);
       }
     }
-  #else
-    float min_cost = findleastcost(cost, cost_table);
-  #endif
-
-  #ifdef TIMING
-    #ifdef EMBEDDED
-      gettimeofday(&end, NULL);
-      t_us = (end.tv_sec - start.tv_sec)*1000000 + end.tv_usec - start.tv_usec;
-      printf("Initialization took %ld us\n", t_us);
-    #else
-      end = clock();
-      milliseconds = ((double)(end - start)) / CLOCKS_PER_SEC;
-      printf("Initialization took %f s\n", milliseconds);
-    #endif
-  #endif
-
-  #ifdef VERBOSE
-    printf("Initial population least cost: %.0f\n", min_cost);
-  #endif
-  // -----------End Initialization-----------
-  // -------------Begin GA Loop--------------
-  bool stopping_criteria_met = false;
-  int generation_count = 0;
 
-  while(!stopping_criteria_met){
-    #ifdef TIMING
-      #ifdef EMBEDDED
-        gettimeofday(&startgen, NULL);
-        gettimeofday(&start, NULL);
-      #else
-        startgen = clock();
-        start = clock();
-      #endif
-    #endif
-    // Select Parents
-    #ifdef PARALLEL
-    // Launch threads
-      for(i=0; i<NUM_THREADS; i++){
-        status = pthread_create(&thread[i], NULL, selection, (void *) &thread_args[i]);
-        if ( status != 0 ) { perror("(main) Can't create thread"); free(thread); exit(-1); }
-      }
-      // Wait for all threads to complete
-      for(i=0; i<NUM_THREADS; i++){
-        pthread_join(thread[i], NULL);
-      }
-    #else
-    selection(cost, parents);
-    #endif
-
-    #ifdef TIMING
-      #ifdef EMBEDDED
-        gettimeofday(&end, NULL);
-        t_us = (end.tv_sec - start.tv_sec)*1000000 + end.tv_usec - start.tv_usec;
-        printf("Gen %d: Selection took %ld us\n", generation_count,t_us);
-        sel_avg_us += t_us;
-      #else
-        end = clock();
-        milliseconds = ((double)(end - start)) / CLOCKS_PER_SEC;
-        printf("Gen %d: Selection took %f s\n",generation_count, milliseconds);
-      #endif
-    #endif
-    #ifdef DEBUG
-      for(i=0; i<POPULATION_SIZE*2; i++){
-        if(parents[i] < 0 || parents[i] >= POPULATION_SIZE){
-          printf("Parent %d has invalid value %d\n", i, parents[i]);
-        }
-      }
-    #endif
-    #ifdef TIMING
-      #ifdef EMBEDDED
-        gettimeofday(&start, NULL);
-      #else
-        start = clock();
-      #endif
-    #endif
-
-    // Crossover
-    #ifdef PARALLEL
-    // Launch threads
-      for(i=0; i<NUM_THREADS; i++){
-        status = pthread_create(&thread[i], NULL, crossover, (void *) &thread_args[i]);
-        if ( status != 0 ) { perror("(main) Can't create thread"); free(thread); exit(-1); }
-      }
-      // Wait for all threads to complete
-      for(i=0; i<NUM_THREADS; i++){
-        pthread_join(thread[i], NULL);
-      }
-    #else
-      crossover(pop, parents, cost_table);
-    #endif
-
-    #ifdef TIMING
-      #ifdef EMBEDDED
-        gettimeofday(&end, NULL);
-        t_us = (end.tv_sec - start.tv_sec)*1000000 + end.tv_usec - start.tv_usec;
-        printf("Gen %d: Crossover took %ld us\n",generation_count, t_us);
-        cross_avg_us += t_us;
-      #else
-        end = clock();
-        milliseconds = ((double)(end - start)) / CLOCKS_PER_SEC;
-        printf("Gen %d: Crossover took %f s\n",generation_count, milliseconds);
-      #endif
-    #endif
-    #ifdef DEBUG
-      for(i=0; i<POPULATION_SIZE; i++){
-        for(j=0; j<NUM_CITIES; j++){
-          if(pop[i][j] < 0 || pop[i][j] >= NUM_CITIES){
-            printf("Population member %d has invalid city %d at index %d\n", i, pop[i][j], j);
-          }
-        }
-      }
-    #endif
-
-    #ifdef TIMING
-      #ifdef EMBEDDED
-        gettimeofday(&start, NULL);
-      #else
-        start = clock();
-      #endif
-    #endif
-    // Mutation
-    #ifdef PARALLEL
-    // Launch threads
-      for(i=0; i<NUM_THREADS; i++){
-        status = pthread_create(&thread[i], NULL, mutation, (void *) &thread_args[i]);
-        if ( status != 0 ) { perror("(main) Can't create thread"); free(thread); exit(-1); }
-      }
-      // Wait for all threads to complete
-      for(i=0; i<NUM_THREADS; i++){
-        pthread_join(thread[i], NULL);
-      }
-    #else
-    mutation(pop);
-    #endif
-    #ifdef TIMING
-      #ifdef EMBEDDED
-        gettimeofday(&end, NULL);
-        t_us = (end.tv_sec - start.tv_sec)*1000000 + end.tv_usec - start.tv_usec;
-        printf("Gen %d: Mutation took %ld us\n",generation_count, t_us);
-        mut_avg_us += t_us;
-      #else
-        end = clock();
-        milliseconds = ((double)(end - start)) / CLOCKS_PER_SEC;
-        printf("Gen %d: Mutation took %f s\n",generation_count, milliseconds);
-      #endif
-    #endif
-
-    #ifdef DEBUG
-      for(i=0; i<POPULATION_SIZE; i++){
-        for(j=0; j<NUM_CITIES; j++){
-          if(pop[i][j] < 0 || pop[i][j] >= NUM_CITIES){
-            printf("Population member %d has invalid city %d at index %d\n", i, pop[i][j], j);
-          }
-        }
-      }
-    #endif
-
-    // Population's Fitness
-    #ifdef TIMING
-      #ifdef EMBEDDED
-        gettimeofday(&start, NULL);
-      #else
-        start = clock();
-      #endif
-    #endif
-    #ifdef PARALLEL
-      // Launch threads
-      for(i=0; i<NUM_THREADS; i++){
-        status = pthread_create(&thread[i], NULL, cost_update, (void *) &thread_args[i]);
-        if ( status != 0 ) { perror("(main) Can't create thread"); free(thread); exit(-1); }
-      }
-      // Wait for all threads to complete
-      for(i=0; i<NUM_THREADS; i++){
-        pthread_join(thread[i], NULL);
-      }
-    #else
-    cost_update(pop, cost, cost_table);
-    #endif
-
-    #ifdef TIMING
-      #ifdef EMBEDDED
-        gettimeofday(&end, NULL);
-        t_us = (end.tv_sec - start.tv_sec)*1000000 + end.tv_usec - start.tv_usec;
-        printf("Gen %d: Cost Update took %ld us\n", generation_count,t_us);
-        fit_avg_us += t_us;
-      #else
-        end = clock();
-        milliseconds = ((double)(end - start)) / CLOCKS_PER_SEC;
-        printf("Gen %d: Cost Update took %f s\n",generation_count, milliseconds);
-      #endif
-    #endif
-
-    #ifdef TIMING
-      #ifdef EMBEDDED
-        gettimeofday(&start, NULL);
-      #else
-        start = clock();
-      #endif
-    #endif
-
-    #ifdef PARALLEL
-      // Launch threads
-      for(i=0; i<NUM_THREADS; i++){
-        status = pthread_create(&thread[i], NULL, findleastcost, (void *) &thread_args[i]);
-        if ( status != 0 ) { perror("(main) Can't create thread"); free(thread); exit(-1); }
-      }
-      // Wait for all threads to complete
-      for(i=0; i<NUM_THREADS; i++){
-        pthread_join(thread[i], NULL);
-      }
-      // Find minimum from outputs
-      float min_cost = min[0];
-      for(i=1; i<NUM_THREADS; i++){
-        if(min[i] < min_cost){
-          min_cost = min[i];
-        }
-      }
-    #else
-      min_cost = findleastcost(cost, cost_table);
-    #endif
-    #ifdef TIMING
-      #ifdef EMBEDDED
-        gettimeofday(&end, NULL);
-        t_us = (end.tv_sec - start.tv_sec)*1000000 + end.tv_usec - start.tv_usec;
-        printf("Gen %d: Minimum Cost took %ld us\n", generation_count,t_us);
-        min_avg_us += t_us;
-      #else
-        end = clock();
-        milliseconds = ((double)(end - start)) / CLOCKS_PER_SEC;
-        printf("Gen %d: Minimum Cost took %f s\n",generation_count, milliseconds);
-      #endif
-    #endif
-    printf("Generation %d's minimum cost: \t %.0f\n",generation_count,min_cost);
-    
-    #ifdef TIMING
-      #ifdef EMBEDDED
-        gettimeofday(&endgen, NULL);
-        t_us = (endgen.tv_sec - startgen.tv_sec)*1000000 + end.tv_usec - start.tv_usec;
-        printf("Gen %d took %ld us\n",generation_count, t_us);
-        gen_avg_us += t_us;
-      #else
-        endgen = clock();
-        milliseconds = ((double)(endgen - startgen)) / CLOCKS_PER_SEC;
-        printf("Gen %d took %f s\n",generation_count, milliseconds);
-      #endif
-    #endif
-
-    // Stopping Conditions
-    generation_count++;
-    if(generation_count == NUM_GENERATIONS){
-      stopping_criteria_met = true;
+    solver->run();
+    // Islands and the steady state time their whole pass as one phase
+    if(config.timing && (config.mode == ISLANDS || config.mode == STEADY)){
+      solver->print_timing(-1);
     }
+    print_result(solver, ga_instance_name(inst));
+    ga_free_instance(inst);
   }
-  // --------------End GA Loop---------------
-  
-  #ifdef EMBEDDED
-  // Timing report:
-    fit_avg_us /= generation_count;
-    min_avg_us /= generation_count;
-    mut_avg_us /= generation_count;
-    sel_avg_us /= generation_count;
-    cross_avg_us /= generation_count;
-    gen_avg_us /= generation_count;
-    
-    printf("\n TIMING REPORT: (values in us)\n");
-    printf("------------------------------\n");
-    printf("Averaged across %d generations\n", generation_count);
-    printf("------------------------------\n");
-    printf("SELECTION\tCROSSOVER\tMUTATION\tCOST_UPDATE\tMINIMUM_COST\tGENERATION\n");
-    printf("%ld\t\t%ld\t\t%ld\t\t%ld\t\t%ld\t\t%d\n", sel_avg_us, cross_avg_us, mut_avg_us, fit_avg_us, min_avg_us, gen_avg_us);
-    printf("------------------------------\n");
-  #endif
-  // Free memory
-  for(i=0; i<POPULATION_SIZE; i++){
-    free(pop[i]);
-  }
-  free(pop);
-  free(cost);
-  free(parents);
-  for(i = 0; i<NUM_CITIES; i++){
-    free(cost_table[i]);
-  }
-  free(cost_table);
-  #ifdef PARALLEL
-    free(thread_args);
-    free(thread);
-  #endif
+  delete solver;
 
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "consts.cpp"
+#include "population.cpp"
+#include "distance.cpp"
+#include "rng.cpp"
+#include "tour_hash.cpp"
+#pragma once
+
+// Mutation operators that return the change in path length they cause.
+// Only the edges next to the moved genes change, so the delta costs O(1)
+// distance lookups and a mutated chromosome keeps a valid cost without
+// re-summing all num_cities-1 edges. Positions are always >= 1 so city 0
+// stays at the start of the path.
+//
+// Defining VERIFY_DELTAS in consts.cpp re-evaluates every mutated chromosome
+// with path_length() and reports deltas that don't match.
+
+
+// Length of the edge leaving position p, 0 past the end of the path
+template<typename Gene, typename Dist>
+static inline float edge_after(const Dist &dist, const Gene *genes, int p){
+  return (p + 1 < num_cities) ? dist(genes[p], genes[p+1]) : 0.0f;
+}
+
+// Swap the genes at positions p and q
+template<typename Gene, typename Dist>
+float swap_mutation(const Dist &dist, Gene *genes, int p, int q){
+  if(p == q) return 0.0f;
+  if(p > q){ int t = p; p = q; q = t; }
+  // Edges touching p and q; when they are adjacent (p, q) is counted once
+  float before = edge_after(dist, genes, p-1) + edge_after(dist, genes, p) + edge_after(dist, genes, q);
+  if(q != p + 1) before += edge_after(dist, genes, q-1);
+  Gene temp = genes[p];
+  genes[p] = genes[q];
+  genes[q] = temp;
+  float after = edge_after(dist, genes, p-1) + edge_after(dist, genes, p) + edge_after(dist, genes, q);
+  if(q != p + 1) after += edge_after(dist, genes, q-1);
+  return after - before;
+}
+
+// Change in length from reversing the segment [p, q], 1 <= p < q.
+// Distances are symmetric, so only the two edges at the ends change.
+template<typename Gene, typename Dist>
+inline float two_opt_delta(const Dist &dist, const Gene *genes, int p, int q){
+  float delta = dist(genes[p-1], genes[q]) - dist(genes[p-1], genes[p]);
+  if(q + 1 < num_cities){
+    delta += dist(genes[p], genes[q+1]) - dist(genes[q], genes[q+1]);
+  }
+  return delta;
+}
+
+// Reverse the segment [p, q] (2-opt move)
+template<typename Gene, typename Dist>
+float two_opt_mutation(const Dist &dist, Gene *genes, int p, int q){
+  if(p == q) return 0.0f;
+  if(p > q){ int t = p; p = q; q = t; }
+  float delta = two_opt_delta(dist, genes, p, q);
+  while(p < q){
+    Gene temp = genes[p];
+    genes[p] = genes[q];
+    genes[q] = temp;
+    p++;
+    q--;
+  }
+  return delta;
+}
+
+// Change in length from moving the segment of len genes starting at p so
+// it follows position k. k must lie outside [p-1, p+len-1]
+template<typename Gene, typename Dist>
+inline float or_opt_delta(const Dist &dist, const Gene *genes, int p, int len, int k){
+  int last = p + len - 1;
+  Gene first_city = genes[p], last_city = genes[last];
+  // Close the gap the segment leaves behind
+  float delta = -dist(genes[p-1], first_city) - edge_after(dist, genes, last);
+  if(last + 1 < num_cities){
+    delta += dist(genes[p-1], genes[last+1]);
+  }
+  // Open the edge (k, k+1) and put the segment inside it
+  delta += dist(genes[k], first_city) - edge_after(dist, genes, k);
+  if(k + 1 < num_cities){
+    delta += dist(last_city, genes[k+1]);
+  }
+  return delta;
+}
+
+// Move the segment of len (at most 3) genes starting at p so it follows
+// position k (Or-opt move). k must lie outside [p-1, p+len-1]
+template<typename Gene, typename Dist>
+float or_opt_mutation(const Dist &dist, Gene *genes, int p, int len, int k){
+  int last = p + len - 1;
+  float delta = or_opt_delta(dist, genes, p, len, k);
+  Gene segment[3];
+  int i;
+  for(i = 0; i < len; i++){
+    segment[i] = genes[p+i];
+  }
+  if(k > last){
+    // Slide (last, k] left over the segment
+    for(i = p; i + len <= k; i++){
+      genes[i] = genes[i+len];
+    }
+    for(i = 0; i < len; i++){
+      genes[k-len+1+i] = segment[i];
+    }
+  }else{
+    // Slide (k, p) right over the segment
+    for(i = p - 1; i > k; i--){
+      genes[i+len] = genes[i];
+    }
+    for(i = 0; i < len; i++){
+      genes[k+1+i] = segment[i];
+    }
+  }
+  return delta;
+}
+
+// Positions whose outgoing edge a move replaces, before and after the
+// move; XORing their edge keys out and in keeps a tour hash up to date
+typedef struct {
+  int before[4], after[4];
+  int count;
+} MoveEdges;
+
+static void move_edges(MutationOperator op, int p, int q, int len, int k, MoveEdges *e){
+  if(p > q && op != OR_OPT){ int t = p; p = q; q = t; }
+  switch(op){
+    case TWO_OPT:
+      // The reversed segment keeps its inner edges
+      e->count = 2;
+      e->before[0] = e->after[0] = p - 1;
+      e->before[1] = e->after[1] = q;
+      break;
+    case OR_OPT: {
+      int last = p + len - 1;
+      e->count = 3;
+      e->before[0] = p - 1; e->before[1] = last; e->before[2] = k;
+      if(k > last){
+        e->after[0] = p - 1; e->after[1] = k - len; e->after[2] = k;
+      }else{
+        e->after[0] = k; e->after[1] = k + len; e->after[2] = last;
+      }
+      break;
+    }
+    default:
+      // Adjacent positions share the edge (p, q)
+      e->count = (q == p + 1) ? 3 : 4;
+      e->before[0] = e->after[0] = p - 1;
+      e->before[1] = e->after[1] = p;
+      e->before[2] = e->after[2] = q;
+      e->before[3] = e->after[3] = q - 1;
+      break;
+  }
+}
+
+// Apply one random move of the given operator and return its delta.
+// A non-NULL hash (see tour_hash.cpp) is updated for the move.
+template<typename Gene, typename Dist>
+float random_mutation(const Dist &dist, Gene *genes, MutationOperator op, Rng *rng, uint64_t *hash){
+  int span = num_cities - 1; // Positions 1..num_cities-1 may move
+  if(span < 2) return 0.0f;
+  int p = 1 + rng_bounded(rng, span);
+  int q = 1 + rng_bounded(rng, span);
+  int len = 0, k = 0;
+  if(op == OR_OPT){
+    len = 1 + rng_bounded(rng, 3);
+    if(len > span - 1) len = span - 1;
+    if(p + len > num_cities) p = num_cities - len;
+    // Destination: any position outside [p-1, p+len-1]
+    int choices = span + 1 - (len + 1);
+    k = rng_bounded(rng, choices);
+    if(k >= p - 1) k += len + 1;
+  }else if(p == q){
+    return 0.0f;
+  }
+  MoveEdges edges;
+  if(hash){
+    move_edges(op, p, q, len, k, &edges);
+    *hash ^= edge_keys_at(genes, edges.before, edges.count);
+  }
+  float delta;
+  switch(op){
+    case TWO_OPT:
+      delta = two_opt_mutation(dist, genes, p, q);
+      break;
+    case OR_OPT:
+      delta = or_opt_mutation(dist, genes, p, len, k);
+      break;
+    default:
+      delta = swap_mutation(dist, genes, p, q);
+      break;
+  }
+  if(hash){
+    *hash ^= edge_keys_at(genes, edges.after, edges.count);
+  }
+  return delta;
+}
+
+// Check a carried cost against a full re-evaluation
+template<typename Gene, typename Dist>
+bool verify_delta(const Dist &dist, const Gene *genes, float carried, const char *op_name, int member){
+  float actual = path_length(dist, genes);
+  if(fabsf(actual - carried) > 1e-3f*fabsf(actual) + 1e-2f){
+    printf("%s delta mismatch on member %d: carried %f, actual %f\n", op_name, member, carried, actual);
+    return false;
+  }
+  return true;
+}
+
+const char* mutation_operator_name(MutationOperator op){
+  switch(op){
+    case TWO_OPT: return "2-opt";
+    case OR_OPT: return "or-opt";
+    default: return "swap";
+  }
+}
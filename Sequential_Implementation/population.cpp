@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "consts.cpp"
+#pragma once
+
+#define CACHE_LINE 64
+
+// Smallest unsigned integer that can hold every city index of an instance
+// with N cities. The population is streamed by cost_update, crossover and
+// mutation every generation, so narrower genes directly cut memory traffic.
+// GASolver (ga_solver.cpp) dispatches to the instantiation matching the loaded instance.
+template<long N, bool fits8 = (N <= 256), bool fits16 = (N <= 65536)>
+struct GeneFor { typedef uint32_t type; };
+template<long N, bool fits16>
+struct GeneFor<N, true, fits16> { typedef uint8_t type; };
+template<long N>
+struct GeneFor<N, false, true> { typedef uint16_t type; };
+
+// Contiguous storage for two generations of the population and their costs.
+// Chromosome i of a buffer starts at buffer + i*num_cities. Crossover reads
+// parents from the current buffer and writes children (and their costs)
+// into the next one; swapping the pointers then makes the children the
+// current population without copying or reallocating anything.
+template<typename Gene>
+struct PopArena {
+  void *raw;           // Unaligned block returned by malloc, kept for free()
+  Gene *cur;           // Current generation
+  Gene *next;          // Destination of the next crossover
+  float *cost;         // Cost of each member of cur
+  float *next_cost;    // Cost of each member of next
+  uint8_t *cost_valid; // Set when cost[i] matches member i of cur
+  uint8_t *next_valid;
+};
+
+// Allocate both population buffers as one cache-line aligned block.
+// False when out of memory; arena_free() releases what was allocated.
+template<typename Gene>
+bool arena_init(PopArena<Gene> *arena){
+  size_t genes = (size_t)config.population_size * num_cities;
+  // Round each buffer up to whole cache lines so both start aligned
+  size_t buf_bytes = (genes*sizeof(Gene) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+  // One spare line for the alignment and one because the SIMD cost kernels
+  // gather genes as 32-bit words and may read a few bytes past the end
+  arena->raw = malloc(2*buf_bytes + 2*CACHE_LINE);
+  arena->cost = (float *) calloc(config.population_size, sizeof(float));
+  arena->next_cost = (float *) calloc(config.population_size, sizeof(float));
+  arena->cost_valid = (uint8_t *) calloc(config.population_size, sizeof(uint8_t));
+  arena->next_valid = (uint8_t *) calloc(config.population_size, sizeof(uint8_t));
+  arena->cur = arena->next = NULL;
+  if(arena->raw == NULL || arena->cost == NULL || arena->next_cost == NULL
+     || arena->cost_valid == NULL || arena->next_valid == NULL){
+    return false;
+  }
+  uintptr_t base = ((uintptr_t)arena->raw + CACHE_LINE - 1) & ~(uintptr_t)(CACHE_LINE - 1);
+  arena->cur = (Gene *) base;
+  arena->next = (Gene *)(base + buf_bytes);
+  memset(arena->cur, 0, 2*buf_bytes);
+  return true;
+}
+
+// Make the buffer crossover just filled the current population
+template<typename Gene>
+void arena_swap(PopArena<Gene> *arena){
+  Gene *temp = arena->cur;
+  arena->cur = arena->next;
+  arena->next = temp;
+  float *temp_cost = arena->cost;
+  arena->cost = arena->next_cost;
+  arena->next_cost = temp_cost;
+  uint8_t *temp_valid = arena->cost_valid;
+  arena->cost_valid = arena->next_valid;
+  arena->next_valid = temp_valid;
+}
+
+template<typename Gene>
+void arena_free(PopArena<Gene> *arena){
+  free(arena->raw);
+  free(arena->cost);
+  free(arena->next_cost);
+  free(arena->cost_valid);
+  free(arena->next_valid);
+  arena->raw = NULL;
+  arena->cur = NULL;
+  arena->next = NULL;
+}
+
+// Pointer to the first gene of chromosome i in a population buffer
+template<typename Gene>
+inline Gene* chromosome(Gene *pop, int i){
+  return pop + (size_t)i*num_cities;
+}
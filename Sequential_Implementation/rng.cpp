@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include "consts.cpp"
+#pragma once
+
+// Random number streams for the GA.
+// The generator is xoshiro256++ (Blackman & Vigna). Every random decision
+// draws from a stream keyed by (run seed, generation, phase, member index),
+// so a member sees the same numbers whichever thread processes it and a
+// given config.seed gives bit-identical runs for any config.threads.
+// rng_jump() provides independent long-lived per-thread streams where work
+// is not tied to a member index.
+
+typedef struct {
+  uint64_t s[4];
+} Rng;
+
+// Phases that draw random numbers; part of the stream key
+enum RngPhase { RNG_INIT = 1, RNG_SELECTION, RNG_MUTATION, RNG_FUSED, RNG_THREAD, RNG_MIGRATION, RNG_DEDUP, RNG_STEADY };
+
+static inline uint64_t rotl64(uint64_t x, int k){
+  return (x << k) | (x >> (64 - k));
+}
+
+// SplitMix64 step, used to expand keys into generator state
+static inline uint64_t splitmix64(uint64_t *x){
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+inline void rng_seed(Rng *rng, uint64_t seed){
+  rng->s[0] = splitmix64(&seed);
+  rng->s[1] = splitmix64(&seed);
+  rng->s[2] = splitmix64(&seed);
+  rng->s[3] = splitmix64(&seed);
+}
+
+inline uint64_t rng_next(Rng *rng){
+  uint64_t *s = rng->s;
+  uint64_t result = rotl64(s[0] + s[3], 23) + s[0];
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl64(s[3], 45);
+  return result;
+}
+
+// Uniform integer in [0, range) without modulo bias (Lemire's method:
+// multiply-shift, rejecting only the rare draws that land in the biased
+// low fraction)
+inline uint32_t rng_bounded(Rng *rng, uint32_t range){
+  uint32_t x = (uint32_t)(rng_next(rng) >> 32);
+  uint64_t m = (uint64_t)x * range;
+  uint32_t low = (uint32_t)m;
+  if(low < range){
+    uint32_t threshold = (uint32_t)(-range) % range;
+    while(low < threshold){
+      x = (uint32_t)(rng_next(rng) >> 32);
+      m = (uint64_t)x * range;
+      low = (uint32_t)m;
+    }
+  }
+  return (uint32_t)(m >> 32);
+}
+
+// Uniform float in [0, 1)
+inline float rng_float(Rng *rng){
+  return (rng_next(rng) >> 40) * (1.0f / 16777216.0f);
+}
+
+// Uniform double in [0, 1)
+inline double rng_double(Rng *rng){
+  return (rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Advance the stream by 2^128 draws; successive jumps from one seed give
+// non-overlapping streams
+void rng_jump(Rng *rng){
+  static const uint64_t JUMP[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                   0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+  uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  int i, b;
+  for(i = 0; i < 4; i++){
+    for(b = 0; b < 64; b++){
+      if(JUMP[i] & ((uint64_t)1 << b)){
+        s0 ^= rng->s[0];
+        s1 ^= rng->s[1];
+        s2 ^= rng->s[2];
+        s3 ^= rng->s[3];
+      }
+      rng_next(rng);
+    }
+  }
+  rng->s[0] = s0;
+  rng->s[1] = s1;
+  rng->s[2] = s2;
+  rng->s[3] = s3;
+}
+
+// Key of one phase of one generation; combined with a member index by
+// rng_member()
+inline uint64_t rng_key(uint64_t seed, int generation, RngPhase phase){
+  uint64_t x = seed ^ ((uint64_t)(uint32_t)generation << 32 | (uint32_t)phase);
+  return splitmix64(&x);
+}
+
+// Stream of one member (or parent slot) within a keyed phase
+inline Rng rng_member(uint64_t key, uint64_t member){
+  Rng rng;
+  rng_seed(&rng, key ^ (member * 0xd1342543de82ef95ULL));
+  return rng;
+}
+
+// Long-lived stream for thread t: the run's base stream jumped t+1 times
+Rng rng_thread(uint64_t seed, int thread){
+  Rng rng;
+  int i;
+  rng_seed(&rng, rng_key(seed, 0, RNG_THREAD));
+  for(i = 0; i <= thread; i++){
+    rng_jump(&rng);
+  }
+  return rng;
+}
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "consts.cpp"
+#include "thread_pool.cpp"
+#include "stopping.cpp"
+#include "simd_cost.cpp"
+#pragma once
+
+// Dynamic scheduling of the population-parallel phases (work stealing).
+// Every thread's [start, end) slice is cut into chunks. A thread works
+// through the chunks of its own slice and, once they run out, takes the
+// chunks still left in the other threads' slices, so a thread that drew
+// expensive children or shares its core with another job no longer holds
+// the whole phase up. Taking a chunk is one fetch-and-add on the slice's
+// cursor, whether by its owner or by a thief.
+//
+// Which thread runs a chunk never changes the result: every member's
+// random stream is keyed by its index (see rng.cpp), and what the threads
+// collect on the side (TopK lists, duplicate counts) is merged in an order
+// that doesn't depend on who collected what.
+//
+// A chunk costs one atomic, and the phase can end with threads idle for up
+// to one chunk. Unless config.chunk fixes the size, every task gets its
+// own, retuned after each run so that a chunk takes about CHUNK_TARGET_NS.
+// The time per member comes from the busy time the pool's probes record
+// around every task (see instrument.cpp). Sizes are multiples of
+// CHUNK_ALIGN, the group of the widest cost kernel (see simd_cost.cpp), so
+// no chunk leaves cost_update with only its scalar tail, and stay at or
+// below STOP_CHUNK, so a stop request is still seen within a chunk.
+
+#define CHUNK_TARGET_NS 50000
+#define CHUNK_ALIGN COST_GROUP_MAX
+#define MIN_CHUNK CHUNK_ALIGN
+#define MAX_CHUNK STOP_CHUNK
+#define FIRST_CHUNK 64   // Before a task has been timed
+#define MAX_SCHED_TASKS 16
+
+// One thread's slice. The cursor is shared with the thieves; the counters
+// below it are written only by the thread itself.
+typedef struct {
+  alignas(CACHE_LINE) int next; // Next chunk to hand out, past count once all are taken
+  int count;                    // Chunks in the slice
+  int start, end;
+  alignas(CACHE_LINE) long members; // In chunks this thread ran, during the current task
+  long chunks, stolen;
+} ChunkQueue;
+
+// Tuned chunk size of one task
+typedef struct {
+  phase_fn task;
+  const char *label;
+  int chunk;
+  long runs, chunks, stolen;
+} SchedTask;
+
+typedef struct {
+  ChunkQueue *queues; // One per pool thread
+  int threads;
+  int chunk;          // Members per chunk of the running task
+  SchedTask tasks[MAX_SCHED_TASKS];
+  int task_count;
+} ChunkScheduler;
+
+// False when out of memory
+bool scheduler_init(ChunkScheduler *s, int threads){
+  memset(s, 0, sizeof(ChunkScheduler));
+  s->threads = threads;
+  s->queues = (ChunkQueue *) aligned_alloc(CACHE_LINE, threads*sizeof(ChunkQueue));
+  if(s->queues == NULL) return false;
+  memset(s->queues, 0, threads*sizeof(ChunkQueue));
+  return true;
+}
+
+void scheduler_free(ChunkScheduler *s){
+  free(s->queues);
+}
+
+// Thread t owns [start, end) of the population
+void scheduler_set_slice(ChunkScheduler *s, int t, int start, int end){
+  s->queues[t].start = start;
+  s->queues[t].end = end;
+}
+
+// Entry of task, NULL once the table is full (the task then runs untuned)
+static SchedTask* scheduler_task(ChunkScheduler *s, phase_fn task, const char *label){
+  int k;
+  for(k = 0; k < s->task_count; k++){
+    if(s->tasks[k].task == task) return &s->tasks[k];
+  }
+  if(s->task_count == MAX_SCHED_TASKS) return NULL;
+  SchedTask *entry = &s->tasks[s->task_count++];
+  entry->task = task;
+  entry->label = label;
+  entry->chunk = FIRST_CHUNK;
+  return entry;
+}
+
+// config.chunk rounded up to a multiple of CHUNK_ALIGN, 0 when tuned
+static inline int fixed_chunk(){
+  return (config.chunk + CHUNK_ALIGN - 1) / CHUNK_ALIGN * CHUNK_ALIGN;
+}
+
+// Run a task that takes its work through chunk_next() on every thread,
+// then retune the task's chunk size from the threads' busy time in it.
+// Without probes on the pool the sizes stay at FIRST_CHUNK.
+void pool_run_chunked(ThreadPool *pool, ChunkScheduler *s, phase_fn task, const char *label){
+  SchedTask *entry = scheduler_task(s, task, label);
+  int t;
+  s->chunk = config.chunk > 0 ? fixed_chunk() : entry ? entry->chunk : FIRST_CHUNK;
+  uint64_t busy_ns = 0;
+  // The pool's start barrier publishes the reset to the workers
+  for(t = 0; t < s->threads; t++){
+    ChunkQueue *q = &s->queues[t];
+    q->next = 0;
+    q->count = (q->end - q->start + s->chunk - 1) / s->chunk;
+    q->members = q->chunks = q->stolen = 0;
+    if(pool->probes) busy_ns -= pool->probes[t].busy.ns;
+  }
+  pool_run(pool, task);
+
+  if(entry == NULL) return;
+  long members = 0;
+  for(t = 0; t < s->threads; t++){
+    if(pool->probes) busy_ns += pool->probes[t].busy.ns;
+    members += s->queues[t].members;
+    entry->chunks += s->queues[t].chunks;
+    entry->stolen += s->queues[t].stolen;
+  }
+  entry->runs++;
+  if(config.chunk == 0 && pool->probes && members > 0 && busy_ns > 0){
+    double per_member = (double) busy_ns / members;
+    // Round down to a power of two, so timing noise rarely moves it
+    int chunk = MIN_CHUNK;
+    while(chunk < MAX_CHUNK && 2*chunk*per_member <= CHUNK_TARGET_NS) chunk *= 2;
+    entry->chunk = chunk;
+  }
+}
+
+// A thread's walk over the chunks of one task
+typedef struct {
+  ChunkScheduler *s;
+  int self;   // Thread running the task
+  int victim; // Slice chunks are taken from
+  int first;  // Members below it are skipped
+} ChunkCursor;
+
+inline ChunkCursor chunk_begin(ChunkScheduler *s, int self, int first){
+  ChunkCursor c;
+  c.s = s;
+  c.self = self;
+  c.victim = self;
+  c.first = first;
+  return c;
+}
+
+// Next chunk [lo, hi) for the cursor's thread: its own slice's first, then
+// the other slices'. False once every chunk is taken or a stop was requested.
+bool chunk_next(ChunkCursor *c, int *lo, int *hi){
+  ChunkScheduler *s = c->s;
+  ChunkQueue *own = &s->queues[c->self];
+  while(!stop_requested()){
+    ChunkQueue *q = &s->queues[c->victim];
+    int k = q->count;
+    // Don't touch the cursor of a slice that is already used up
+    if(__atomic_load_n(&q->next, __ATOMIC_RELAXED) < q->count){
+      k = __atomic_fetch_add(&q->next, 1, __ATOMIC_RELAXED);
+    }
+    if(k < q->count){
+      int begin = q->start + k*s->chunk;
+      int end = (q->end - begin > s->chunk) ? begin + s->chunk : q->end;
+      if(begin < c->first) begin = c->first;
+      if(begin >= end) continue;
+      own->chunks++;
+      own->members += end - begin;
+      if(c->victim != c->self) own->stolen++;
+      *lo = begin;
+      *hi = end;
+      return true;
+    }
+    c->victim = (c->victim + 1) % s->threads;
+    if(c->victim == c->self) return false;
+  }
+  return false;
+}
+
+// Chunk sizes the tasks settled on and how much was stolen
+void scheduler_print(const ChunkScheduler *s){
+  int k;
+  long chunks = 0, stolen = 0;
+  for(k = 0; k < s->task_count; k++){
+    chunks += s->tasks[k].chunks;
+    stolen += s->tasks[k].stolen;
+  }
+  printf("Scheduler: %ld of %ld chunks stolen; members per chunk:", stolen, chunks);
+  for(k = 0; k < s->task_count; k++){
+    printf(" %s %d%s", s->tasks[k].label, config.chunk > 0 ? fixed_chunk() : s->tasks[k].chunk,
+      k + 1 < s->task_count ? "," : "\n");
+  }
+  if(s->task_count == 0) printf(" -\n");
+}
@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "consts.cpp"
+#include "rng.cpp"
+#pragma once
+
+// Selection engines. Every engine fills parents[] the same way: slot i and
+// slot i+config.population_size are the two parents of child i. config.selection in
+// consts.cpp picks the engine.
+//
+//   TOURNAMENT  best of config.tournament_size uniform draws; the draws of a
+//               tournament are made in batches and their costs prefetched,
+//               so the random reads into cost[] overlap
+//   RANK        linear ranking over the population sorted once per
+//               generation (slices sort in parallel, main merges the runs);
+//               a draw inverts the rank CDF in O(1)
+//   SUS         stochastic universal sampling: 2*config.population_size evenly
+//               spaced pointers over the cumulative weights, one random
+//               offset per generation, walked in order through the prefix
+//               sums
+//   ALIAS       Vose alias table built once per generation, O(1) draws that
+//               touch a single 8-byte entry
+//
+// SUS and ALIAS are fitness proportional with weight (max - cost) plus a
+// small floor, so the worst member keeps a non-zero chance.
+
+
+// Tournament draws made (and prefetched) before their costs are compared
+#define TOURNAMENT_BATCH 16
+
+typedef struct {
+  float prob;  // Chance of keeping the drawn column
+  int alias;   // Member taken otherwise
+} AliasEntry;
+
+// Per-generation state of the selection engine; only the arrays the
+// method needs are allocated
+typedef struct {
+  SelectionMethod method;
+  uint64_t *order;     // RANK: cost bits << 32 | member, ascending
+  double *prefix;      // SUS: prefix[m] = sum of the weights of members 0..m
+  AliasEntry *table;   // ALIAS: one entry per member
+  int *work;           // ALIAS: small/large worklists while building
+  double sus_offset;   // SUS: position of pointer 0
+  double sus_step;     // SUS: distance between pointers
+  uint64_t sus_stride; // SUS: pointer k fills slot k*stride mod 2*config.population_size
+  uint64_t sus_inverse;// SUS: stride's inverse, maps a slot back to its pointer
+} SelectionTables;
+
+const char* selection_method_name(SelectionMethod method){
+  switch(method){
+    case RANK: return "rank";
+    case SUS: return "sus";
+    case ALIAS: return "alias";
+    default: return "tournament";
+  }
+}
+
+// False when out of memory; selection_free() releases what was allocated
+bool selection_init(SelectionTables *t, SelectionMethod method){
+  memset(t, 0, sizeof(SelectionTables));
+  t->method = method;
+  if(method == RANK){
+    t->order = (uint64_t *) malloc(config.population_size*sizeof(uint64_t));
+    return t->order != NULL;
+  }else if(method == SUS){
+    t->prefix = (double *) malloc(config.population_size*sizeof(double));
+    return t->prefix != NULL;
+  }else if(method == ALIAS){
+    t->table = (AliasEntry *) malloc(config.population_size*sizeof(AliasEntry));
+    t->work = (int *) malloc(config.population_size*sizeof(int));
+    return t->table != NULL && t->work != NULL;
+  }
+  return true;
+}
+
+void selection_free(SelectionTables *t){
+  free(t->order);
+  free(t->prefix);
+  free(t->table);
+  free(t->work);
+}
+
+// ---- Per-generation preparation ----
+
+// RANK: sort members [start, end) of order by cost. Costs are never
+// negative, so their float bits order like the values, and the member index
+// in the low half breaks ties the same way on every run.
+void rank_sort(SelectionTables *t, const float *cost, int start, int end){
+  int i;
+  if(t->method != RANK) return;
+  for(i = start; i != end; i++){
+    uint32_t bits;
+    memcpy(&bits, &cost[i], sizeof(bits));
+    t->order[i] = ((uint64_t)bits << 32) | (uint32_t)i;
+  }
+  std::sort(t->order + start, t->order + end);
+}
+
+// RANK: merge the sorted runs [0, mid) and [mid, end)
+void rank_merge(SelectionTables *t, int mid, int end){
+  std::inplace_merge(t->order, t->order + mid, t->order + end);
+}
+
+// Selection weight of a cost; larger is fitter
+static inline double selection_weight(float cost, float max_cost, double base){
+  return (double)(max_cost - cost) + base;
+}
+
+static uint64_t gcd64(uint64_t a, uint64_t b){
+  while(b){ uint64_t r = a % b; a = b; b = r; }
+  return a;
+}
+
+// Inverse of a modulo m (a and m coprime)
+static uint64_t inverse_mod(uint64_t a, uint64_t m){
+  int64_t r0 = m, r1 = a, s0 = 0, s1 = 1;
+  while(r1){
+    int64_t q = r0 / r1, tmp;
+    tmp = r0 - q*r1; r0 = r1; r1 = tmp;
+    tmp = s0 - q*s1; s0 = s1; s1 = tmp;
+  }
+  return (uint64_t)((s0 % (int64_t)m + (int64_t)m) % (int64_t)m);
+}
+
+// Whole-population part of the preparation, run once per generation after
+// rank_sort. key is the generation's RNG_SELECTION key.
+void selection_prepare(SelectionTables *t, const float *cost, uint64_t key){
+  int i;
+  if(t->method != SUS && t->method != ALIAS) return;
+  float min_cost = cost[0], max_cost = cost[0];
+  for(i = 1; i < config.population_size; i++){
+    min_cost = fminf(min_cost, cost[i]);
+    max_cost = fmaxf(max_cost, cost[i]);
+  }
+  // All equal costs give equal weights
+  double base = (max_cost > min_cost) ? (double)(max_cost - min_cost) / config.population_size : 1.0;
+
+  if(t->method == SUS){
+    double total = 0.0;
+    for(i = 0; i < config.population_size; i++){
+      total += selection_weight(cost[i], max_cost, base);
+      t->prefix[i] = total;
+    }
+    // One draw past the last slot's stream sets the pointers for the
+    // generation. The pointers come out in fitness order, so a random
+    // stride coprime to the slot count spreads them over the slots and
+    // keeps consecutive pointers from always being mated.
+    uint64_t slots = 2*(uint64_t)config.population_size;
+    Rng rng = rng_member(key, slots);
+    t->sus_step = total / slots;
+    t->sus_offset = rng_double(&rng) * t->sus_step;
+    do{
+      t->sus_stride = 1 + rng_bounded(&rng, (uint32_t)(slots - 1));
+    }while(gcd64(t->sus_stride, slots) != 1);
+    t->sus_inverse = inverse_mod(t->sus_stride, slots);
+    return;
+  }
+
+  // ALIAS (Vose): scale the weights to average 1, then pair every column
+  // below 1 with one above 1 that tops it up
+  double total = 0.0;
+  for(i = 0; i < config.population_size; i++){
+    total += selection_weight(cost[i], max_cost, base);
+  }
+  double scale = config.population_size / total;
+  // Small columns fill work[] from the front, large ones from the back
+  int small = 0, large = config.population_size;
+  for(i = 0; i < config.population_size; i++){
+    t->table[i].prob = (float)(selection_weight(cost[i], max_cost, base) * scale);
+    t->table[i].alias = i;
+    if(t->table[i].prob < 1.0f){
+      t->work[small++] = i;
+    }else{
+      t->work[--large] = i;
+    }
+  }
+  while(small > 0 && large < config.population_size){
+    int s = t->work[--small];
+    int l = t->work[large];
+    t->table[s].alias = l;
+    t->table[l].prob -= 1.0f - t->table[s].prob;
+    if(t->table[l].prob < 1.0f){
+      large++;
+      t->work[small++] = l;
+    }
+  }
+  // Whatever is left only differs from 1 by rounding
+  while(small > 0) t->table[t->work[--small]].prob = 1.0f;
+  while(large < config.population_size) t->table[t->work[large++]].prob = 1.0f;
+}
+
+// ---- Draws ----
+
+// Run one tournament of ROUNDS random members of cost[0, size) and return
+// the index of the cheapest (the first one drawn wins ties). The power-of-two
+// sizes 2, 4, ..., 256 are instantiated with ROUNDS fixed, so the batches
+// are unrolled; every other size runs ROUNDS 0, the same batched loop with
+// the count read from config.tournament_size at run time.
+template<int ROUNDS>
+inline int tournament_n(const float *cost, int size, Rng *rng){
+  const int rounds = ROUNDS ? ROUNDS : config.tournament_size;
+  int batch[TOURNAMENT_BATCH];
+  int j, k, count;
+  int best_index = 0;
+  float best_cost = INFINITY;
+  for(j = 0; j < rounds; j += count){
+    count = (rounds - j < TOURNAMENT_BATCH) ? rounds - j : TOURNAMENT_BATCH;
+    for(k = 0; k < count; k++){
+      batch[k] = rng_bounded(rng, size);
+      __builtin_prefetch(&cost[batch[k]]);
+    }
+    for(k = 0; k < count; k++){
+      if(cost[batch[k]] < best_cost){
+        best_cost = cost[batch[k]];
+        best_index = batch[k];
+      }
+    }
+  }
+  return best_index;
+}
+
+// Tournament of config.tournament_size members (see tournament_n for which
+// sizes have their own instantiation)
+inline int tournament(const float *cost, int size, Rng *rng){
+  switch(config.tournament_size){
+    case 2: return tournament_n<2>(cost, size, rng);
+    case 4: return tournament_n<4>(cost, size, rng);
+    case 8: return tournament_n<8>(cost, size, rng);
+    case 16: return tournament_n<16>(cost, size, rng);
+    case 32: return tournament_n<32>(cost, size, rng);
+    case 64: return tournament_n<64>(cost, size, rng);
+    case 128: return tournament_n<128>(cost, size, rng);
+    case 256: return tournament_n<256>(cost, size, rng);
+    default: return tournament_n<0>(cost, size, rng);
+  }
+}
+
+// Tournament selection of parents[start, end), one instantiation per size
+template<int ROUNDS>
+void tournament_selection(const float *cost, int *parents, int start, int end, uint64_t key){
+  int i;
+  for(i = start; i != end; i++){
+    Rng rng = rng_member(key, i);
+    parents[i] = tournament_n<ROUNDS>(cost, config.population_size, &rng);
+  }
+}
+
+// Linear ranking: rank r (0 = cheapest) has weight config.population_size - r, so
+// the cumulative weight below rank r is C(r) = r*N - r*(r-1)/2. Solving
+// C(r) = u*total for r gives the rank directly.
+inline int rank_draw(const SelectionTables *t, Rng *rng){
+  const double n = config.population_size;
+  double target = rng_double(rng) * (n*(n+1)/2);
+  double b = n + 0.5;
+  int r = (int)(b - sqrt(b*b - 2*target));
+  // Correct the rounding of the square root
+  if(r < 0) r = 0;
+  if(r > config.population_size-1) r = config.population_size-1;
+  while(r > 0 && (double)r*n - (double)r*(r-1)/2 > target) r--;
+  while(r < config.population_size-1 && (double)(r+1)*n - (double)(r+1)*r/2 <= target) r++;
+  return (int)(uint32_t)t->order[r];
+}
+
+inline int alias_draw(const SelectionTables *t, Rng *rng){
+  int column = rng_bounded(rng, config.population_size);
+  AliasEntry entry = t->table[column];
+  return (rng_float(rng) < entry.prob) ? column : entry.alias;
+}
+
+// SUS: member under pointer k
+inline int sus_pointer(const SelectionTables *t, uint64_t k){
+  double p = t->sus_offset + k*t->sus_step;
+  int m = std::upper_bound(t->prefix, t->prefix + config.population_size, p) - t->prefix;
+  return (m < config.population_size) ? m : config.population_size-1;
+}
+
+// One parent for slot (i or i+config.population_size for child i); used by the
+// fused generation, which picks its parents child by child
+inline int select_parent(const SelectionTables *t, const float *cost, int slot, Rng *rng){
+  switch(t->method){
+    case RANK: return rank_draw(t, rng);
+    case ALIAS: return alias_draw(t, rng);
+    case SUS: return sus_pointer(t, (slot*t->sus_inverse) % (2*(uint64_t)config.population_size));
+    default: return tournament(cost, config.population_size, rng);
+  }
+}
+
+// Choose parents for the next generation. [start, end) indexes parents[],
+// which holds two parents per member of the population. key is the phase's
+// RNG key. SUS treats [start, end) as a range of pointers instead and walks
+// it in order; the stride scatters them over every slot exactly once, so
+// slices still fill disjoint parts of parents[].
+void selection(const SelectionTables *t, const float *cost, int *parents, int start, int end, uint64_t key){
+  int i;
+  if(t->method == SUS){
+    const uint64_t slots = 2*(uint64_t)config.population_size;
+    int m = sus_pointer(t, start);
+    for(i = start; i != end; i++){
+      double p = t->sus_offset + i*t->sus_step;
+      while(m < config.population_size-1 && t->prefix[m] <= p) m++;
+      parents[(i*t->sus_stride) % slots] = m;
+    }
+    return;
+  }
+  if(t->method == TOURNAMENT){
+    switch(config.tournament_size){
+      case 2: tournament_selection<2>(cost, parents, start, end, key); return;
+      case 4: tournament_selection<4>(cost, parents, start, end, key); return;
+      case 8: tournament_selection<8>(cost, parents, start, end, key); return;
+      case 16: tournament_selection<16>(cost, parents, start, end, key); return;
+      case 32: tournament_selection<32>(cost, parents, start, end, key); return;
+      case 64: tournament_selection<64>(cost, parents, start, end, key); return;
+      case 128: tournament_selection<128>(cost, parents, start, end, key); return;
+      case 256: tournament_selection<256>(cost, parents, start, end, key); return;
+      default: tournament_selection<0>(cost, parents, start, end, key); return;
+    }
+  }
+  // Select a two parents for every member of the next generation
+  for(i = start; i != end; i++){
+    Rng rng = rng_member(key, i);
+    parents[i] = (t->method == RANK) ? rank_draw(t, &rng) : alias_draw(t, &rng);
+  }
+}
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "consts.cpp"
+#include "population.cpp"
+#include "distance.cpp"
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+#endif
+#pragma once
+
+// Batched tour-length kernels for cost_update over a DenseDistance table.
+// Instead of walking one chromosome at a time, a group of 8 (AVX2) or 16
+// (AVX-512) chromosomes is evaluated together: step j gathers gene j of
+// every chromosome in the group, forms the flat table index prev*n + cur
+// and gathers the edge lengths. Each lane adds its edges in the same order
+// as the scalar loop, so the costs are bit-identical to path_length().
+// The instruction set is chosen once at runtime from the CPU's features.
+// The kernels are also instantiated for common TSPLIB city counts (template
+// parameter N), giving the gene loop a constant trip count the compiler can
+// unroll; N = 0 is the generic kernel that reads num_cities.
+
+enum CostISA { ISA_SCALAR, ISA_AVX2, ISA_AVX512 };
+
+CostISA detect_cost_isa(){
+  #if defined(__x86_64__) || defined(__i386__)
+    if(__builtin_cpu_supports("avx512f")) return ISA_AVX512;
+    if(__builtin_cpu_supports("avx2")) return ISA_AVX2;
+  #endif
+  return ISA_SCALAR;
+}
+
+const char* cost_isa_name(CostISA isa){
+  switch(isa){
+    case ISA_AVX512: return "avx512";
+    case ISA_AVX2: return "avx2";
+    default: return "scalar";
+  }
+}
+
+// Chromosomes per group of the widest kernel
+#define COST_GROUP_MAX 16
+
+// Detected once; cost_update reads it every call
+static const CostISA cost_isa = detect_cost_isa();
+
+// True when every member of a group already has a valid cost
+static inline bool group_valid(const uint8_t *cost_valid, int count){
+  int k;
+  for(k = 0; k < count; k++){
+    if(!cost_valid[k]) return false;
+  }
+  return true;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Genes are gathered as 32-bit words from byte offsets, so narrower genes
+// need the neighbouring bytes masked off (the arena pads its end for this)
+template<typename Gene>
+static inline int gene_mask(){
+  return (sizeof(Gene) == 4) ? -1 : (int)((1u << (8*sizeof(Gene))) - 1);
+}
+
+template<int N, typename Gene>
+__attribute__((target("avx2")))
+static int cost_update_avx2(Gene *pop, float *cost, uint8_t *cost_valid, const DenseDistance &dist, int start, int end){
+  const int cities = N ? N : num_cities;
+  const __m256i mask = _mm256_set1_epi32(gene_mask<Gene>());
+  const __m256i n = _mm256_set1_epi32(dist.n);
+  const int stride = cities*sizeof(Gene);
+  const __m256i lane_offset = _mm256_mullo_epi32(_mm256_setr_epi32(0,1,2,3,4,5,6,7), _mm256_set1_epi32(stride));
+  const __m256i step = _mm256_set1_epi32(sizeof(Gene));
+  int i, j;
+  for(i = start; i + 8 <= end; i += 8){
+    if(group_valid(cost_valid + i, 8)) continue;
+    const int *base = (const int *) chromosome(pop, i);
+    __m256i offset = lane_offset;
+    __m256i prev = _mm256_and_si256(_mm256_i32gather_epi32(base, offset, 1), mask);
+    __m256 total = _mm256_setzero_ps();
+    for(j = 1; j < cities; j++){
+      offset = _mm256_add_epi32(offset, step);
+      __m256i cur = _mm256_and_si256(_mm256_i32gather_epi32(base, offset, 1), mask);
+      __m256i idx = _mm256_add_epi32(_mm256_mullo_epi32(prev, n), cur);
+      total = _mm256_add_ps(total, _mm256_i32gather_ps(dist.table, idx, 4));
+      prev = cur;
+    }
+    _mm256_storeu_ps(cost + i, total);
+    memset(cost_valid + i, 1, 8);
+  }
+  return i; // First chromosome left for the scalar loop
+}
+
+template<int N, typename Gene>
+__attribute__((target("avx512f")))
+static int cost_update_avx512(Gene *pop, float *cost, uint8_t *cost_valid, const DenseDistance &dist, int start, int end){
+  const int cities = N ? N : num_cities;
+  const __m512i mask = _mm512_set1_epi32(gene_mask<Gene>());
+  const __m512i n = _mm512_set1_epi32(dist.n);
+  const int stride = cities*sizeof(Gene);
+  const __m512i lane_offset = _mm512_mullo_epi32(
+    _mm512_setr_epi32(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15), _mm512_set1_epi32(stride));
+  const __m512i step = _mm512_set1_epi32(sizeof(Gene));
+  // Explicit masked gathers (GCC 12 warns about the unmasked forms)
+  const __m512i zero = _mm512_setzero_si512();
+  const __mmask16 all = 0xFFFF;
+  int i, j;
+  for(i = start; i + 16 <= end; i += 16){
+    if(group_valid(cost_valid + i, 16)) continue;
+    const int *base = (const int *) chromosome(pop, i);
+    __m512i offset = lane_offset;
+    __m512i prev = _mm512_and_si512(_mm512_mask_i32gather_epi32(zero, all, offset, base, 1), mask);
+    __m512 total = _mm512_setzero_ps();
+    for(j = 1; j < cities; j++){
+      offset = _mm512_add_epi32(offset, step);
+      __m512i cur = _mm512_and_si512(_mm512_mask_i32gather_epi32(zero, all, offset, base, 1), mask);
+      __m512i idx = _mm512_add_epi32(_mm512_mullo_epi32(prev, n), cur);
+      total = _mm512_add_ps(total, _mm512_mask_i32gather_ps(_mm512_castsi512_ps(zero), all, idx, dist.table, 4));
+      prev = cur;
+    }
+    _mm512_storeu_ps(cost + i, total);
+    memset(cost_valid + i, 1, 16);
+  }
+  return i;
+}
+#endif
+
+// Scalar tour length with N cities (0: num_cities)
+template<int N, typename Gene>
+static inline float path_length_n(const DenseDistance &dist, const Gene *genes){
+  const int cities = N ? N : num_cities;
+  float total = 0.0;
+  int j;
+  for(j = 1; j < cities; j++){
+    total += dist(genes[j-1], genes[j]);
+  }
+  return total;
+}
+
+// cost_update for the dense table: vector groups first, scalar remainder.
+// A group is skipped when all of its members are valid; otherwise the whole
+// group is re-evaluated, which is cheaper than splitting it up.
+template<int N, typename Gene>
+void cost_update_dense(Gene *pop, float *cost, uint8_t *cost_valid, const DenseDistance &dist, int start, int end){
+  int i = start;
+  #if defined(__x86_64__) || defined(__i386__)
+    // The gathers use 32-bit indices into the table
+    if((int64_t)dist.n*dist.n < INT32_MAX){
+      if(cost_isa == ISA_AVX512){
+        i = cost_update_avx512<N>(pop, cost, cost_valid, dist, start, end);
+      }else if(cost_isa == ISA_AVX2){
+        i = cost_update_avx2<N>(pop, cost, cost_valid, dist, start, end);
+      }
+    }
+  #endif
+  for(; i != end; i++){
+    if(!cost_valid[i]){
+      cost[i] = path_length_n<N>(dist, chromosome(pop, i));
+      cost_valid[i] = 1;
+    }
+  }
+}
+
+// Pick the kernel for the instance's city count. Gene limits which counts
+// are possible, so only those cases are instantiated.
+template<typename Gene>
+void cost_update(Gene *pop, float *cost, uint8_t *cost_valid, const DenseDistance &dist, int start, int end){
+  if(sizeof(Gene) == 1){
+    switch(num_cities){
+      case 48: cost_update_dense<48>(pop, cost, cost_valid, dist, start, end); return;   // att48
+      case 51: cost_update_dense<51>(pop, cost, cost_valid, dist, start, end); return;   // eil51
+      case 52: cost_update_dense<52>(pop, cost, cost_valid, dist, start, end); return;   // berlin52
+      case 70: cost_update_dense<70>(pop, cost, cost_valid, dist, start, end); return;   // st70
+      case 76: cost_update_dense<76>(pop, cost, cost_valid, dist, start, end); return;   // eil76, pr76
+      case 100: cost_update_dense<100>(pop, cost, cost_valid, dist, start, end); return; // kroA100..kroE100
+      case 150: cost_update_dense<150>(pop, cost, cost_valid, dist, start, end); return; // ch150
+      case 200: cost_update_dense<200>(pop, cost, cost_valid, dist, start, end); return; // kroA200
+    }
+  }
+  cost_update_dense<0>(pop, cost, cost_valid, dist, start, end);
+}
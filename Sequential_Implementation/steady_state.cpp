@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "consts.cpp"
+#include "population.cpp"
+#include "rng.cpp"
+#include "selection.cpp"
+#include "GA_functions.cpp"
+#include "stopping.cpp"
+#pragma once
+
+// Steady-state GA (the STEADY mode). There are no generations and no
+// barriers: every worker thread loops on its own, picking two parents by
+// tournament, building a child with crossover and mutation, and writing it
+// over the loser of a reverse tournament (the most expensive of
+// config.tournament_size random members) when the child is cheaper. Every
+// member is a slot in arena->cur that any thread may read or replace at any
+// time, so a slow or descheduled thread holds nobody up.
+//
+// Each slot has a sequence number (a seqlock). A writer makes it odd with
+// a compare-and-swap, copies the child in and makes it even again; a second
+// writer that finds it odd drops its child instead of waiting, as does one
+// that finds the slot already replaced by a child at least as cheap. A reader
+// copies the tour and rereads the sequence, and retries if a write started
+// or finished in between. Tournaments read the costs without the seqlock:
+// a cost read during a write is the old or the new one, which only changes
+// which member is picked.
+//
+// For the report, every config.population_size children count as one
+// generation; the run ends after config.generations of them (or on a
+// time limit or target). Which slot a child lands in depends on thread
+// timing, so with more than one thread runs are not bit-identical. The
+// steady state doesn't exchange tours with other processes.
+
+typedef struct {
+  uint32_t *seq;               // Per member; odd while the slot is being written
+  alignas(CACHE_LINE) long tickets; // Children started so far
+  alignas(CACHE_LINE) uint32_t best_bits; // Least cost so far, as float bits
+  float *generation_min;       // Least cost at the end of each generation, INFINITY if not reached
+  long *replaced;              // Per thread: children written into the population
+  long *dropped;               // Per thread: children lost to a busy or since improved slot
+} SteadyState;
+
+void steady_free(SteadyState *s){
+  free(s->seq);
+  free(s->generation_min);
+  free(s->replaced);
+  free(s->dropped);
+}
+
+// False when out of memory, with nothing left allocated
+bool steady_init(SteadyState *s, int threads, float initial_min){
+  int g;
+  s->seq = (uint32_t *) calloc(config.population_size, sizeof(uint32_t));
+  s->generation_min = (float *) malloc((size_t)config.generations*sizeof(float));
+  s->replaced = (long *) calloc(threads, sizeof(long));
+  s->dropped = (long *) calloc(threads, sizeof(long));
+  if(s->seq == NULL || s->generation_min == NULL || s->replaced == NULL || s->dropped == NULL){
+    steady_free(s);
+    return false;
+  }
+  for(g = 0; g < config.generations; g++){
+    s->generation_min[g] = INFINITY;
+  }
+  s->tickets = 0;
+  // Costs are never negative, so their float bits order like the values
+  memcpy(&s->best_bits, &initial_min, sizeof(float));
+  return true;
+}
+
+static inline float steady_best(const SteadyState *s){
+  uint32_t bits = __atomic_load_n(&s->best_bits, __ATOMIC_RELAXED);
+  float cost;
+  memcpy(&cost, &bits, sizeof(float));
+  return cost;
+}
+
+static inline void steady_offer(SteadyState *s, float cost){
+  uint32_t bits, seen = __atomic_load_n(&s->best_bits, __ATOMIC_RELAXED);
+  memcpy(&bits, &cost, sizeof(float));
+  while(bits < seen && !__atomic_compare_exchange_n(&s->best_bits, &seen, bits, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+// Copy member i into genes, consistent with its cost
+template<typename Gene>
+void steady_read(const SteadyState *s, const PopArena<Gene> *arena, int i, Gene *genes, float *cost){
+  uint32_t before, after;
+  do{
+    before = __atomic_load_n(&s->seq[i], __ATOMIC_ACQUIRE);
+    if(before & 1) continue;
+    memcpy(genes, chromosome(arena->cur, i), num_cities*sizeof(Gene));
+    *cost = arena->cost[i];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&s->seq[i], __ATOMIC_RELAXED);
+  }while((before & 1) || before != after);
+}
+
+// Write genes over member i if it still costs more than the child and no
+// other thread is writing it. Returns false when the slot was busy or got
+// cheaper after the caller looked, so the best member is never lost.
+template<typename Gene>
+bool steady_write(SteadyState *s, PopArena<Gene> *arena, int i, const Gene *genes, float cost){
+  uint32_t seq = __atomic_load_n(&s->seq[i], __ATOMIC_RELAXED);
+  if((seq & 1) || !__atomic_compare_exchange_n(&s->seq[i], &seq, seq + 1, false,
+                                               __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+    return false;
+  }
+  if(!(cost < arena->cost[i])){
+    // Nothing was written; readers that saw seq can keep what they read
+    __atomic_store_n(&s->seq[i], seq, __ATOMIC_RELEASE);
+    return false;
+  }
+  // Readers must see the odd sequence before any of the new genes
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(chromosome(arena->cur, i), genes, num_cities*sizeof(Gene));
+  arena->cost[i] = cost;
+  arena->cost_valid[i] = 1;
+  __atomic_store_n(&s->seq[i], seq + 2, __ATOMIC_RELEASE);
+  return true;
+}
+
+// Most expensive of config.tournament_size random members
+static inline int steady_loser(const float *cost, int size, Rng *rng){
+  int j, worst = rng_bounded(rng, size);
+  for(j = 1; j < config.tournament_size; j++){
+    int k = rng_bounded(rng, size);
+    if(cost[k] > cost[worst]) worst = k;
+  }
+  return worst;
+}
+
+// One worker's loop; returns when the run is over
+template<typename Gene, typename Dist>
+void steady_run(SteadyState *s, PopArena<Gene> *arena, const Dist &dist, int thread, uint64_t seed){
+  Gene *parent1 = (Gene *) malloc(num_cities*sizeof(Gene));
+  Gene *parent2 = (Gene *) malloc(num_cities*sizeof(Gene));
+  Gene *child = (Gene *) malloc(num_cities*sizeof(Gene));
+  uint64_t *used = (uint64_t *) malloc(used_words()*sizeof(uint64_t));
+  Rng rng = rng_member(rng_key(seed, 0, RNG_STEADY), thread);
+  long total = (long)config.generations*config.population_size;
+  long replaced = 0, dropped = 0;
+  while(!stop_requested()){
+    long ticket = __atomic_fetch_add(&s->tickets, 1, __ATOMIC_RELAXED);
+    if(ticket >= total){
+      stop_now(STOP_GENERATIONS);
+      break;
+    }
+    float cost1, cost2;
+    steady_read(s, arena, tournament(arena->cost, config.population_size, &rng), parent1, &cost1);
+    steady_read(s, arena, tournament(arena->cost, config.population_size, &rng), parent2, &cost2);
+    float child_cost = crossover_child(parent1, parent2, child, dist, used, NULL);
+    uint8_t child_valid = 1;
+    mutate_member(child, &child_cost, &child_valid, dist, 0, &rng, NULL);
+
+    int loser = steady_loser(arena->cost, config.population_size, &rng);
+    if(child_cost < arena->cost[loser]){
+      if(steady_write(s, arena, loser, child, child_cost)){
+        replaced++;
+        steady_offer(s, child_cost);
+        if(config.target_cost > 0 && child_cost <= config.target_cost) stop_now(STOP_TARGET);
+      }else{
+        dropped++;
+      }
+    }
+    // The child that completes a generation's worth records the best so far
+    if((ticket + 1) % config.population_size == 0){
+      s->generation_min[(ticket + 1) / config.population_size - 1] = steady_best(s);
+    }
+  }
+  s->replaced[thread] = replaced;
+  s->dropped[thread] = dropped;
+  free(parent1);
+  free(parent2);
+  free(child);
+  free(used);
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include "consts.cpp"
+#include "tracer.cpp"
+#pragma once
+
+// Stopping policies. A run ends at the first of:
+//   config.generations     generations produced (0: no limit)
+//   config.time_limit      seconds of wall time since the run started
+//   config.target_cost     best cost at or below the target
+//   config.stagnation      generations without a better best cost
+//   config.min_diversity   relative spread of the population's costs
+//                          (standard deviation / mean) below the threshold
+// A policy at 0 is off. A GASolver callback can also end the run (see ga_solver.h).
+//
+// The time budget can expire in the middle of a generation. Workers call
+// stop_requested() between chunks of at most STOP_CHUNK members (see
+// scheduler.cpp), so a long phase winds down within one chunk; main then drops the unfinished generation
+// and the run ends with the last complete one and the best tour so far.
+// Islands check between their own generations and report the generations
+// every island finished.
+// The budget counts from the start of the run, but the initial population
+// is always completed so there is a tour to return.
+
+// Members a worker processes between checks of the stop flag
+#define STOP_CHUNK 1024
+
+enum StopReason { STOP_NONE, STOP_GENERATIONS, STOP_TIME, STOP_TARGET, STOP_STAGNATION, STOP_DIVERSITY, STOP_CALLER };
+
+const char* stop_reason_name(StopReason reason){
+  switch(reason){
+    case STOP_GENERATIONS: return "generation limit";
+    case STOP_TIME: return "time budget";
+    case STOP_TARGET: return "target cost reached";
+    case STOP_STAGNATION: return "no improvement";
+    case STOP_DIVERSITY: return "population diversity collapsed";
+    case STOP_CALLER: return "stopped by the caller";
+    default: return "running";
+  }
+}
+
+// The time budget and stop request of one run. The workers read the
+// process-wide stop_clock, which every GASolver call points at its own
+// solver's clock; the one below serves a run without a solver.
+typedef struct {
+  uint64_t start_ns;
+  uint64_t deadline_ns; // 0 without a time budget
+  int flag;             // StopReason once a stop was requested
+} StopClock;
+
+static StopClock stop_default;
+static StopClock *stop_clock = &stop_default;
+
+// Start the clock of a new run
+void stop_begin(){
+  stop_clock->start_ns = monotonic_ns();
+  stop_clock->deadline_ns = 0;
+  __atomic_store_n(&stop_clock->flag, STOP_NONE, __ATOMIC_RELEASE);
+}
+
+// Start enforcing the time budget, once the initial population is complete
+void stop_arm_budget(){
+  stop_clock->deadline_ns = (config.time_limit > 0) ? stop_clock->start_ns + (uint64_t)(config.time_limit*1e9) : 0;
+}
+
+// Ask every thread to wind down; the first reason wins
+void stop_now(StopReason reason){
+  int none = STOP_NONE;
+  __atomic_compare_exchange_n(&stop_clock->flag, &none, (int) reason, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+// True once the run should end; checks the time budget on the way.
+// Sticky, so every thread sees the same answer after the first true.
+inline bool stop_requested(){
+  if(__atomic_load_n(&stop_clock->flag, __ATOMIC_ACQUIRE) != STOP_NONE) return true;
+  if(stop_clock->deadline_ns != 0 && monotonic_ns() >= stop_clock->deadline_ns){
+    stop_now(STOP_TIME);
+    return true;
+  }
+  return false;
+}
+
+StopReason stop_reason(const StopClock *clock = stop_clock){
+  return (StopReason) __atomic_load_n(&clock->flag, __ATOMIC_ACQUIRE);
+}
+
+double stop_elapsed_s(const StopClock *clock = stop_clock){
+  return (monotonic_ns() - clock->start_ns) / 1e9;
+}
+
+// Best cost seen so far and how long it has stood
+typedef struct {
+  float best_cost;
+  int best_generation;
+  int stagnant; // Complete generations since best_cost last improved
+} StopTracker;
+
+void stop_tracker_init(StopTracker *s, float initial_cost){
+  s->best_cost = initial_cost;
+  s->best_generation = -1;
+  s->stagnant = 0;
+}
+
+// Standard deviation over mean of the valid costs
+double cost_diversity(const float *cost, const uint8_t *cost_valid, int n){
+  double sum = 0, sum_sq = 0;
+  int i, count = 0;
+  for(i = 0; i < n; i++){
+    if(!cost_valid[i]) continue;
+    sum += cost[i];
+    sum_sq += (double)cost[i]*cost[i];
+    count++;
+  }
+  if(count == 0 || sum <= 0) return 0;
+  double mean = sum / count;
+  double var = sum_sq / count - mean*mean;
+  return sqrt(var > 0 ? var : 0) / mean;
+}
+
+// Account for complete generation `generation` with least cost min_cost
+void stop_tracker_update(StopTracker *s, int generation, float min_cost){
+  if(min_cost < s->best_cost){
+    s->best_cost = min_cost;
+    s->best_generation = generation;
+    s->stagnant = 0;
+  }else{
+    s->stagnant++;
+  }
+}
+
+// Request a stop if a policy says so after complete generation
+// `generation`, which s has accounted for. Returns true when the run ends.
+bool stop_after_generation(const StopTracker *s, int generation, const float *cost, const uint8_t *cost_valid){
+  if(config.generations > 0 && generation + 1 >= config.generations) stop_now(STOP_GENERATIONS);
+  else if(config.target_cost > 0 && s->best_cost <= config.target_cost) stop_now(STOP_TARGET);
+  else if(config.stagnation > 0 && s->stagnant >= config.stagnation) stop_now(STOP_STAGNATION);
+  else if(config.min_diversity > 0 && cost_diversity(cost, cost_valid, config.population_size) < config.min_diversity){
+    stop_now(STOP_DIVERSITY);
+  }
+  return stop_requested();
+}
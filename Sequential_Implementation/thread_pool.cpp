@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "instrument.cpp"
+#pragma once
+
+// Persistent pool of worker threads. Each worker owns one slice of the
+// population (its TH_args entry) for the whole run and sleeps on a barrier
+// between GA phases, so a phase costs two barrier waits instead of a
+// pthread_create/pthread_join per thread. A pool of one thread starts no
+// workers and runs every phase on the calling thread.
+typedef void* (*phase_fn)(void*);
+
+typedef struct {
+  pthread_t *threads;
+  pthread_barrier_t start_barrier; // Released when a phase is posted
+  pthread_barrier_t done_barrier;  // Released when every slice is finished
+  phase_fn task;                   // Phase the workers run next
+  void *args;                      // Base of the per-thread argument array
+  size_t arg_size;                 // sizeof() one argument entry
+  ThreadProbe *probes;             // Per-thread busy time and counters, NULL when off
+  int num_threads;
+  bool shutdown;
+  // Workers wait here until every one of them was created; if one can't
+  // be, the others leave before they ever reach the barriers
+  pthread_mutex_t ready_lock;
+  pthread_cond_t ready;
+  int started;                     // 0 while creating, 1 when all run, -1 on failure
+} ThreadPool;
+
+typedef struct {
+  ThreadPool *pool;
+  int thrdIdx;
+} PoolWorker;
+
+static void* pool_worker_main(void *arg){
+  PoolWorker *self = (PoolWorker *) arg;
+  ThreadPool *pool = self->pool;
+  void *my_args = (char *) pool->args + self->thrdIdx * pool->arg_size;
+  ThreadProbe *probe = pool->probes ? &pool->probes[self->thrdIdx] : NULL;
+  trace_thread("worker", self->thrdIdx);
+  free(self);
+
+  pthread_mutex_lock(&pool->ready_lock);
+  while(pool->started == 0){
+    pthread_cond_wait(&pool->ready, &pool->ready_lock);
+  }
+  bool abandoned = (pool->started < 0);
+  pthread_mutex_unlock(&pool->ready_lock);
+  if(abandoned) return NULL;
+
+  while(true){
+    pthread_barrier_wait(&pool->start_barrier);
+    if(pool->shutdown){
+      break;
+    }
+    uint64_t t = trace_now();
+    if(probe) probe_begin(probe);
+    pool->task(my_args);
+    if(probe) probe_end(probe);
+    trace_complete(trace_label, t, trace_arg);
+    // Time spent waiting here is this slice waiting for the slowest one
+    t = trace_now();
+    pthread_barrier_wait(&pool->done_barrier);
+    trace_complete("Barrier wait", t, trace_arg);
+  }
+  return NULL;
+}
+
+// Start num_threads workers; worker i is always handed &args[i].
+// probes (one per thread, see instrument.cpp) may be NULL. False when the
+// workers can't be created; no thread is left running then.
+bool pool_init(ThreadPool *pool, int num_threads, void *args, size_t arg_size, ThreadProbe *probes){
+  int i;
+  pool->num_threads = num_threads;
+  pool->args = args;
+  pool->arg_size = arg_size;
+  pool->task = NULL;
+  pool->shutdown = false;
+  pool->threads = NULL;
+  pool->probes = probes;
+  if(num_threads == 1){
+    return true;
+  }
+  pool->threads = (pthread_t *) malloc(num_threads*sizeof(pthread_t));
+  if(pool->threads == NULL) return false;
+  // The calling thread takes part in both barriers
+  pthread_barrier_init(&pool->start_barrier, NULL, num_threads + 1);
+  pthread_barrier_init(&pool->done_barrier, NULL, num_threads + 1);
+  pthread_mutex_init(&pool->ready_lock, NULL);
+  pthread_cond_init(&pool->ready, NULL);
+  pool->started = 0;
+
+  int created = 0;
+  while(created < num_threads){
+    PoolWorker *worker = (PoolWorker *) malloc(sizeof(PoolWorker));
+    if(worker == NULL) break;
+    worker->pool = pool;
+    worker->thrdIdx = created;
+    if(pthread_create(&pool->threads[created], NULL, pool_worker_main, (void *) worker) != 0){
+      free(worker);
+      break;
+    }
+    created++;
+  }
+  pthread_mutex_lock(&pool->ready_lock);
+  pool->started = (created == num_threads) ? 1 : -1;
+  pthread_cond_broadcast(&pool->ready);
+  pthread_mutex_unlock(&pool->ready_lock);
+  if(pool->started > 0){
+    return true;
+  }
+  for(i=0; i<created; i++){
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_barrier_destroy(&pool->start_barrier);
+  pthread_barrier_destroy(&pool->done_barrier);
+  pthread_mutex_destroy(&pool->ready_lock);
+  pthread_cond_destroy(&pool->ready);
+  free(pool->threads);
+  pool->threads = NULL;
+  return false;
+}
+
+// Run one phase on every slice and wait for all of them to finish.
+// The barriers order the writes of one phase before the reads of the next.
+void pool_run(ThreadPool *pool, phase_fn task){
+  if(pool->num_threads == 1){
+    if(pool->probes) probe_begin(pool->probes);
+    task(pool->args);
+    if(pool->probes) probe_end(pool->probes);
+    return;
+  }
+  pool->task = task;
+  pthread_barrier_wait(&pool->start_barrier);
+  uint64_t t = trace_now();
+  pthread_barrier_wait(&pool->done_barrier);
+  trace_complete("Barrier wait", t, trace_arg);
+}
+
+// Wake the workers one last time so they exit, then join them. Does
+// nothing for a pool whose pool_init() failed.
+void pool_destroy(ThreadPool *pool){
+  int i;
+  if(pool->num_threads == 1 || pool->threads == NULL){
+    return;
+  }
+  pool->shutdown = true;
+  pthread_barrier_wait(&pool->start_barrier);
+  for(i=0; i<pool->num_threads; i++){
+    pthread_join(pool->threads[i], NULL);
+  }
+  pthread_barrier_destroy(&pool->start_barrier);
+  pthread_barrier_destroy(&pool->done_barrier);
+  pthread_mutex_destroy(&pool->ready_lock);
+  pthread_cond_destroy(&pool->ready);
+  free(pool->threads);
+}
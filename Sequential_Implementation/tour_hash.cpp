@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "consts.cpp"
+#include "population.cpp"
+#include "rng.cpp"
+#pragma once
+
+// Tour hashes and the duplicate table (--dedup).
+// A tour's hash is the XOR of a 64-bit key per undirected edge (Zobrist
+// hashing over the edge set), so it doesn't depend on the direction the
+// edges are walked in. It covers the tour as stored, the open path from
+// city 0 that path_length() prices, without the edge back to city 0; every
+// member starts at city 0, so rotations of one tour never meet. A move that
+// replaces a few edges updates the hash with a few XORs: crossover hashes
+// a child while it picks the child's edges, mutation applies its move's
+// edges (see random_mutation), and local search rehashes only the members
+// it improved.
+//
+// Once per generation every member's hash goes into a TourTable, an
+// open-addressing table shared by the pool threads. Each hash keeps the
+// lowest member index that has it, so which member counts as the original
+// and which as the duplicate doesn't depend on the thread count.
+
+// Random key of the undirected edge (a, b)
+static inline uint64_t edge_key(int a, int b){
+  if(a > b){ int t = a; a = b; b = t; }
+  uint64_t x = ((uint64_t)(uint32_t)a << 32 | (uint32_t)b) ^ 0x5851f42d4c957f2dULL;
+  return splitmix64(&x);
+}
+
+// Key of the edge leaving position p, 0 past the end of the path
+template<typename Gene>
+static inline uint64_t edge_key_after(const Gene *genes, int p){
+  return (p + 1 < num_cities) ? edge_key(genes[p], genes[p+1]) : 0;
+}
+
+// XOR of the keys of the edges leaving positions pos[0, count)
+template<typename Gene>
+static inline uint64_t edge_keys_at(const Gene *genes, const int *pos, int count){
+  uint64_t h = 0;
+  int k;
+  for(k = 0; k < count; k++){
+    h ^= edge_key_after(genes, pos[k]);
+  }
+  return h;
+}
+
+// Hash of the path genes[0] -> ... -> genes[num_cities-1]
+template<typename Gene>
+uint64_t tour_hash(const Gene *genes){
+  uint64_t h = 0;
+  int p;
+  for(p = 0; p + 1 < num_cities; p++){
+    h ^= edge_key(genes[p], genes[p+1]);
+  }
+  return h;
+}
+
+// Slot keys are hashes, 0 marks a free slot (a tour hashing to 0 is stored as 1)
+typedef struct {
+  uint64_t *key;
+  int *member; // Lowest member with the slot's hash, INT32_MAX in a free slot
+  size_t mask; // Slots - 1; at least twice the population, a power of two
+} TourTable;
+
+// Empty the slots [begin, end) of the table
+void tour_table_clear(TourTable *t, size_t begin, size_t end){
+  size_t s;
+  memset(t->key + begin, 0, (end - begin)*sizeof(uint64_t));
+  for(s = begin; s < end; s++){
+    t->member[s] = INT32_MAX;
+  }
+}
+
+// False when out of memory; tour_table_free() releases what was allocated
+bool tour_table_init(TourTable *t){
+  size_t slots = 1;
+  while(slots < 2*(size_t)config.population_size) slots <<= 1;
+  t->mask = slots - 1;
+  t->key = (uint64_t *) malloc(slots*sizeof(uint64_t));
+  t->member = (int *) malloc(slots*sizeof(int));
+  if(t->key == NULL || t->member == NULL) return false;
+  tour_table_clear(t, 0, slots);
+  return true;
+}
+
+void tour_table_free(TourTable *t){
+  free(t->key);
+  free(t->member);
+}
+
+static inline uint64_t tour_table_key(uint64_t hash){
+  return hash != 0 ? hash : 1;
+}
+
+// Record member i with the given hash. Safe to call from every thread at
+// once; the table can't fill up since it has twice as many slots as members.
+void tour_table_insert(TourTable *t, uint64_t hash, int i){
+  uint64_t key = tour_table_key(hash);
+  size_t s = key & t->mask;
+  while(true){
+    uint64_t seen = __atomic_load_n(&t->key[s], __ATOMIC_ACQUIRE);
+    if(seen == 0){
+      // Claim the free slot, unless another thread gets there first
+      uint64_t expected = 0;
+      if(__atomic_compare_exchange_n(&t->key[s], &expected, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+        seen = key;
+      }else{
+        seen = expected;
+      }
+    }
+    if(seen == key){
+      // Keep the lowest member index
+      int current = __atomic_load_n(&t->member[s], __ATOMIC_RELAXED);
+      while(i < current && !__atomic_compare_exchange_n(&t->member[s], &current, i, true,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+      return;
+    }
+    s = (s + 1) & t->mask;
+  }
+}
+
+// Lowest member recorded with the hash, -1 if none
+int tour_table_find(const TourTable *t, uint64_t hash){
+  uint64_t key = tour_table_key(hash);
+  size_t s = key & t->mask;
+  while(t->key[s] != 0){
+    if(t->key[s] == key) return t->member[s];
+    s = (s + 1) & t->mask;
+  }
+  return -1;
+}
+
+size_t tour_table_slots(const TourTable *t){
+  return t->mask + 1;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "consts.cpp"
+#include "population.cpp"
+#pragma once
+
+// Timeline tracer (--trace FILE). Every thread records complete events
+// (name, start, duration) into its own ring, so recording is a clock read
+// and a 32-byte store with no locks or shared cache lines. A full ring
+// overwrites its oldest events. At exit the rings are written as a
+// Chrome trace-event JSON file that chrome://tracing and Perfetto open,
+// with one track per thread: main's phases and generations, each worker's
+// tasks and barrier waits, and migrations. Gaps on a worker's track are
+// time it sat parked between phases.
+//
+// Names must be string literals (or otherwise live until exit); an event
+// carries one integer argument, the generation, or -1 for none.
+// With tracing off every call returns after one branch.
+
+// Events each thread keeps; a power of two
+#define TRACE_RING_EVENTS 65536
+#define MAX_TRACE_THREADS 256
+
+typedef struct {
+  uint64_t start_ns;
+  uint64_t dur_ns;
+  const char *name;
+  int64_t arg;
+} TraceEvent;
+
+typedef struct {
+  alignas(CACHE_LINE) uint64_t count; // Events ever recorded; the ring holds the last TRACE_RING_EVENTS
+  TraceEvent *events;
+  const char *name;
+  int index;
+} TraceRing;
+
+inline uint64_t monotonic_ns(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+bool trace_on = false;
+static const char *trace_path;
+static uint64_t trace_epoch;
+static TraceRing trace_rings[MAX_TRACE_THREADS];
+static int trace_thread_count = 0;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread TraceRing *trace_self = NULL;
+
+// Name of the phase the pool is running and its generation. Set by main
+// before a phase starts; the pool's barrier publishes it to the workers.
+const char *trace_label = "Task";
+int trace_arg = -1;
+
+// Give the calling thread a track named "name index" (index < 0: just name).
+// A thread of a later run with the same name and index reuses the track.
+void trace_thread(const char *name, int index){
+  int k;
+  if(!trace_on) return;
+  pthread_mutex_lock(&trace_lock);
+  for(k = 0; k < trace_thread_count; k++){
+    if(trace_rings[k].index == index && strcmp(trace_rings[k].name, name) == 0) break;
+  }
+  if(k == trace_thread_count && k < MAX_TRACE_THREADS){
+    trace_rings[k].events = (TraceEvent *) malloc(TRACE_RING_EVENTS*sizeof(TraceEvent));
+    if(trace_rings[k].events != NULL){
+      trace_rings[k].count = 0;
+      trace_rings[k].name = name;
+      trace_rings[k].index = index;
+      trace_thread_count++;
+    }
+  }
+  // Threads past MAX_TRACE_THREADS, or whose ring couldn't be allocated, are not traced
+  trace_self = (k < trace_thread_count) ? &trace_rings[k] : NULL;
+  pthread_mutex_unlock(&trace_lock);
+}
+
+// Start time for trace_complete; 0 when tracing is off
+inline uint64_t trace_now(){
+  return trace_on ? monotonic_ns() : 0;
+}
+
+// Record an event of the calling thread that began at start (trace_now())
+inline void trace_complete(const char *name, uint64_t start, int arg){
+  if(!trace_on || trace_self == NULL) return;
+  TraceRing *ring = trace_self;
+  TraceEvent *e = &ring->events[ring->count & (TRACE_RING_EVENTS - 1)];
+  e->start_ns = start;
+  e->dur_ns = monotonic_ns() - start;
+  e->name = name;
+  e->arg = arg;
+  ring->count++;
+}
+
+// Label of the pool tasks that follow
+inline void trace_phase(const char *name, int arg){
+  trace_label = name;
+  trace_arg = arg;
+}
+
+static void trace_write(){
+  int t;
+  uint64_t k;
+  FILE *out = fopen(trace_path, "w");
+  if(out == NULL){ perror(trace_path); return; }
+  int pid = (int) getpid();
+  bool first = true;
+  fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  for(t = 0; t < trace_thread_count; t++){
+    const TraceRing *ring = &trace_rings[t];
+    fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                 "\"args\": {\"name\": \"", first ? "" : ",\n", pid, t);
+    if(ring->index >= 0) fprintf(out, "%s %d\"}}", ring->name, ring->index);
+    else fprintf(out, "%s\"}}", ring->name);
+    first = false;
+    // Oldest surviving event first
+    uint64_t begin = (ring->count > TRACE_RING_EVENTS) ? ring->count - TRACE_RING_EVENTS : 0;
+    for(k = begin; k < ring->count; k++){
+      const TraceEvent *e = &ring->events[k & (TRACE_RING_EVENTS - 1)];
+      fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+        e->name, pid, t, (e->start_ns - trace_epoch)/1e3, e->dur_ns/1e3);
+      if(e->arg >= 0) fprintf(out, ", \"args\": {\"generation\": %lld}", (long long) e->arg);
+      fprintf(out, "}");
+    }
+  }
+  fprintf(out, "\n]}\n");
+  fclose(out);
+  for(t = 0; t < trace_thread_count; t++){
+    free(trace_rings[t].events);
+  }
+}
+
+// Start tracing to path; the file is written when the process exits
+void trace_init(const char *path){
+  trace_path = path;
+  trace_epoch = monotonic_ns();
+  trace_on = true;
+  trace_thread("main", -1);
+  atexit(trace_write);
+}
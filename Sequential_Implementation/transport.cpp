@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "consts.cpp"
+#include "population.cpp"
+#include "islands.cpp"
+#include "GA_functions.cpp"
+#pragma once
+
+// Migration between GA processes. Several GA processes started on the same
+// instance (for example pinned to different sockets or NUMA nodes) form a
+// job; every config.migration_interval generations each process sends its best
+// tours to its neighbours in config.migration_topology over the job's ranks, and
+// arriving tours replace the process's worst members when they are better.
+//
+// A process joins a job through the environment:
+//   GA_NPROCS     number of processes in the job (unset or 1: no migration)
+//   GA_RANK       this process, 0..GA_NPROCS-1
+//   GA_TRANSPORT  "shm" (default) or "socket"
+//   GA_JOB        job name, keeps concurrent jobs apart (default "ga")
+//
+// Backends move opaque messages through the Transport interface, so the
+// GA side only deals in encoded migrants:
+//   shm     one POSIX shared-memory segment holding a single-producer
+//           single-consumer ring of fixed-size slots per ordered pair of
+//           ranks, the same lock-free protocol as the island rings
+//   socket  one Unix-domain datagram socket per rank; a datagram is a
+//           migrant, and a peer that is not up yet just misses it
+// Neither backend ever blocks: full rings, full socket buffers and missing
+// peers drop the migrant. Rank 0 removes the job's shared segment at exit.
+//
+// Rank 0 also creates the segment: it removes any segment left behind by a
+// job that didn't exit cleanly, creates a fresh one (whose pages read as
+// zero, empty rings) and then publishes its pid in the segment's header.
+// The other ranks wait, up to SHM_WAIT_MS, for a segment whose owner is a
+// live process before they touch a ring, so nobody sends into a segment
+// that is about to be replaced, and a leftover is never cleared under a
+// rank that is using it.
+//
+// Nothing that arrives is trusted: a migrant is taken in only if its genes
+// are a tour of this instance starting at city 0, and its cost is summed
+// again here rather than read from the header.
+
+typedef struct {
+  bool (*send)(void *self, int to, const void *msg, size_t len);
+  size_t (*recv)(void *self, void *buf, size_t cap); // 0 when nothing is waiting
+  void (*close)(void *self);
+  void *self;              // Backend state
+  const char *name;
+  int rank, nprocs;
+  IslandTopology topo;     // Over the job's ranks
+  size_t max_message;      // Largest encoded migrant
+  uint64_t *used;          // used_words() of scratch for checking arriving tours
+} Transport;
+
+// ---- Wire format ----
+
+#define MIGRANT_MAGIC 0x474d4731u // "GMG1"
+
+// Fixed header of an encoded migrant; the genes follow at their native
+// width (one byte per city for instances up to 256 cities)
+typedef struct {
+  uint32_t magic;
+  uint16_t gene_bytes;
+  uint16_t source;     // Sending rank
+  uint32_t num_cities;
+  uint32_t epoch;      // Migration the tour was sent in
+  float cost;
+} MigrantHeader;
+
+template<typename Gene>
+size_t migrant_size(){
+  return sizeof(MigrantHeader) + (size_t)num_cities*sizeof(Gene);
+}
+
+template<typename Gene>
+size_t migrant_encode(void *buf, const Gene *genes, float cost, int source, int epoch){
+  MigrantHeader header = { MIGRANT_MAGIC, (uint16_t) sizeof(Gene), (uint16_t) source,
+                           (uint32_t) num_cities, (uint32_t) epoch, cost };
+  memcpy(buf, &header, sizeof(header));
+  memcpy((char *) buf + sizeof(header), genes, num_cities*sizeof(Gene));
+  return migrant_size<Gene>();
+}
+
+// Header of a received message, or NULL when it is not a migrant for this
+// instance (a stale message from an earlier job, say)
+template<typename Gene>
+const MigrantHeader* migrant_check(const void *buf, size_t len, MigrantHeader *header){
+  if(len != migrant_size<Gene>()) return NULL;
+  memcpy(header, buf, sizeof(MigrantHeader));
+  if(header->magic != MIGRANT_MAGIC || header->gene_bytes != sizeof(Gene) ||
+     header->num_cities != (uint32_t) num_cities){
+    return NULL;
+  }
+  return header;
+}
+
+// ---- Shared-memory backend ----
+
+#define SHM_WAIT_MS 10000
+
+// Start of the segment; the rings follow it
+typedef struct {
+  alignas(CACHE_LINE) int32_t owner; // Rank 0's pid once the rings are ready, 0 before
+} ShmSegmentHeader;
+
+// Slot: message length followed by the message
+typedef struct {
+  alignas(CACHE_LINE) uint32_t head; // Written by the receiving rank
+  alignas(CACHE_LINE) uint32_t tail; // Written by the sending rank
+} ShmRingHeader;
+
+typedef struct {
+  char *base;       // Mapping of the whole segment
+  char *rings;      // Past the ShmSegmentHeader
+  size_t size;
+  size_t slot_size; // sizeof(uint32_t) + max_message, rounded to a cache line
+  size_t ring_size;
+  int rank, nprocs;
+  char name[64];
+} ShmTransport;
+
+static ShmRingHeader* shm_ring(ShmTransport *t, int from, int to){
+  return (ShmRingHeader *) (t->rings + (size_t)(from*t->nprocs + to)*t->ring_size);
+}
+
+static bool shm_send(void *self, int to, const void *msg, size_t len){
+  ShmTransport *t = (ShmTransport *) self;
+  ShmRingHeader *ring = shm_ring(t, t->rank, to);
+  uint32_t tail = ring->tail;
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  if(tail - head == MIGRANT_RING_SLOTS || len + sizeof(uint32_t) > t->slot_size) return false;
+  char *slot = (char *)(ring + 1) + (tail & (MIGRANT_RING_SLOTS - 1))*t->slot_size;
+  uint32_t length = (uint32_t) len;
+  memcpy(slot, &length, sizeof(length));
+  memcpy(slot + sizeof(length), msg, len);
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static size_t shm_recv(void *self, void *buf, size_t cap){
+  ShmTransport *t = (ShmTransport *) self;
+  int from;
+  for(from = 0; from < t->nprocs; from++){
+    if(from == t->rank) continue;
+    ShmRingHeader *ring = shm_ring(t, from, t->rank);
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if(head == tail) continue;
+    const char *slot = (const char *)(ring + 1) + (head & (MIGRANT_RING_SLOTS - 1))*t->slot_size;
+    uint32_t length;
+    memcpy(&length, slot, sizeof(length));
+    size_t copied = (length <= cap) ? length : 0; // Oversized messages are skipped
+    memcpy(buf, slot + sizeof(length), copied);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    if(copied > 0) return copied;
+  }
+  return 0;
+}
+
+static void shm_close(void *self){
+  ShmTransport *t = (ShmTransport *) self;
+  munmap(t->base, t->size);
+  if(t->rank == 0){
+    shm_unlink(t->name);
+  }
+  free(t);
+}
+
+// Rank 0: replace any segment of the job's name with a fresh, empty one.
+// Returns its descriptor, or -1 after printing why.
+static int shm_create_segment(ShmTransport *t){
+  shm_unlink(t->name);
+  int fd = shm_open(t->name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if(fd < 0){ perror("(transport) Can't create shared memory"); return -1; }
+  if(ftruncate(fd, t->size) != 0){
+    perror("(transport) Can't size shared memory");
+    close(fd);
+    shm_unlink(t->name);
+    return -1;
+  }
+  return fd;
+}
+
+// Other ranks: the descriptor of the segment rank 0 of this job made
+// ready, or -1 after printing why there is none
+static int shm_join_segment(ShmTransport *t){
+  int waited;
+  for(waited = 0; waited < SHM_WAIT_MS; waited++){
+    int fd = shm_open(t->name, O_RDWR, 0600);
+    struct stat st;
+    if(fd >= 0 && fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(ShmSegmentHeader)){
+      ShmSegmentHeader *header = (ShmSegmentHeader *) mmap(NULL, sizeof(ShmSegmentHeader), PROT_READ, MAP_SHARED, fd, 0);
+      int32_t owner = (header != MAP_FAILED) ? __atomic_load_n(&header->owner, __ATOMIC_ACQUIRE) : 0;
+      if(header != MAP_FAILED) munmap(header, sizeof(ShmSegmentHeader));
+      // A leftover's owner is gone; rank 0 of this job will replace it
+      if(owner != 0 && (kill(owner, 0) == 0 || errno == EPERM)){
+        if((size_t) st.st_size == t->size) return fd;
+        printf("(transport) Shared memory %s belongs to a job of another instance or size\n", t->name);
+        close(fd);
+        return -1;
+      }
+    }
+    if(fd >= 0) close(fd);
+    usleep(1000);
+  }
+  printf("(transport) Rank 0 didn't set up shared memory %s\n", t->name);
+  return -1;
+}
+
+static bool shm_open_transport(Transport *tr, const char *job){
+  ShmTransport *t = (ShmTransport *) calloc(1, sizeof(ShmTransport));
+  if(t == NULL){ perror("(transport) Can't allocate the transport"); return false; }
+  t->rank = tr->rank;
+  t->nprocs = tr->nprocs;
+  t->slot_size = (sizeof(uint32_t) + tr->max_message + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+  t->ring_size = sizeof(ShmRingHeader) + MIGRANT_RING_SLOTS*t->slot_size;
+  t->size = sizeof(ShmSegmentHeader) + (size_t)t->nprocs*t->nprocs*t->ring_size;
+  snprintf(t->name, sizeof(t->name), "/%s-migration", job);
+  int fd = (t->rank == 0) ? shm_create_segment(t) : shm_join_segment(t);
+  if(fd < 0){ free(t); return false; }
+  t->base = (char *) mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(t->base == MAP_FAILED){
+    perror("(transport) Can't map shared memory");
+    if(t->rank == 0) shm_unlink(t->name);
+    free(t);
+    return false;
+  }
+  t->rings = t->base + sizeof(ShmSegmentHeader);
+  ShmSegmentHeader *header = (ShmSegmentHeader *) t->base;
+  if(t->rank == 0){
+    __atomic_store_n(&header->owner, (int32_t) getpid(), __ATOMIC_RELEASE);
+  }
+  tr->self = t;
+  tr->send = shm_send;
+  tr->recv = shm_recv;
+  tr->close = shm_close;
+  tr->name = "shm";
+  return true;
+}
+
+// ---- Unix-domain socket backend ----
+
+typedef struct {
+  int fd;
+  char job[48];
+  struct sockaddr_un addr; // This rank's address
+} SocketTransport;
+
+static void socket_address(struct sockaddr_un *addr, const char *job, int rank){
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  snprintf(addr->sun_path, sizeof(addr->sun_path), "/tmp/%s-%d.sock", job, rank);
+}
+
+static bool socket_send(void *self, int to, const void *msg, size_t len){
+  SocketTransport *t = (SocketTransport *) self;
+  struct sockaddr_un peer;
+  socket_address(&peer, t->job, to);
+  return sendto(t->fd, msg, len, MSG_DONTWAIT, (struct sockaddr *) &peer, sizeof(peer)) == (ssize_t) len;
+}
+
+static size_t socket_recv(void *self, void *buf, size_t cap){
+  SocketTransport *t = (SocketTransport *) self;
+  ssize_t got = recv(t->fd, buf, cap, MSG_DONTWAIT | MSG_TRUNC);
+  // Truncated datagrams are not migrants of this instance
+  return (got > 0 && (size_t) got <= cap) ? (size_t) got : 0;
+}
+
+static void socket_close(void *self){
+  SocketTransport *t = (SocketTransport *) self;
+  close(t->fd);
+  unlink(t->addr.sun_path);
+  free(t);
+}
+
+static bool socket_open_transport(Transport *tr, const char *job){
+  SocketTransport *t = (SocketTransport *) calloc(1, sizeof(SocketTransport));
+  if(t == NULL){ perror("(transport) Can't allocate the transport"); return false; }
+  snprintf(t->job, sizeof(t->job), "%s", job);
+  t->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+  if(t->fd < 0){ perror("(transport) Can't create socket"); free(t); return false; }
+  // Room for a few whole migrants in each direction
+  int buffer = (int)(4*tr->max_message + 4096);
+  setsockopt(t->fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof(buffer));
+  setsockopt(t->fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+  socket_address(&t->addr, job, tr->rank);
+  unlink(t->addr.sun_path); // Left over from an earlier run
+  if(bind(t->fd, (struct sockaddr *) &t->addr, sizeof(t->addr)) != 0){
+    perror("(transport) Can't bind socket");
+    close(t->fd);
+    free(t);
+    return false;
+  }
+  tr->self = t;
+  tr->send = socket_send;
+  tr->recv = socket_recv;
+  tr->close = socket_close;
+  tr->name = "socket";
+  return true;
+}
+
+// ---- Job setup ----
+
+// Join the job described by the environment. Returns false (and leaves
+// migration off) for a single process or when the backend can't be set up.
+template<typename Gene>
+bool transport_open(Transport *tr){
+  const char *nprocs = getenv("GA_NPROCS");
+  const char *rank = getenv("GA_RANK");
+  const char *backend = getenv("GA_TRANSPORT");
+  const char *job = getenv("GA_JOB");
+  memset(tr, 0, sizeof(Transport));
+  tr->nprocs = nprocs ? atoi(nprocs) : 1;
+  tr->rank = rank ? atoi(rank) : 0;
+  if(tr->nprocs < 2) return false;
+  if(tr->rank < 0 || tr->rank >= tr->nprocs || tr->nprocs > UINT16_MAX){
+    printf("(transport) GA_RANK %d is outside a job of %d processes\n", tr->rank, tr->nprocs);
+    return false;
+  }
+  if(job == NULL) job = "ga";
+  tr->max_message = migrant_size<Gene>();
+  topology_init(&tr->topo, tr->nprocs, config.migration_topology, config.seed);
+  bool opened = (backend != NULL && strcmp(backend, "socket") == 0) ? socket_open_transport(tr, job)
+                                                                    : shm_open_transport(tr, job);
+  if(opened){
+    tr->used = (uint64_t *) malloc(used_words()*sizeof(uint64_t));
+    if(tr->used == NULL){
+      tr->close(tr->self);
+      return false;
+    }
+  }
+  return opened;
+}
+
+void transport_close(Transport *tr){
+  if(tr->close != NULL) tr->close(tr->self);
+  free(tr->used);
+  tr->used = NULL;
+}
+
+// ---- GA side ----
+
+// Send the config.migration_size best members of [start, end) to this rank's
+// neighbours for migration number epoch. buf holds max_message bytes.
+template<typename Gene>
+void process_emigrate(Transport *tr, const PopArena<Gene> *arena, int start, int end, int epoch, void *buf){
+  int best[MIGRANT_RING_SLOTS], targets[4]; // migration_size is at most MIGRANT_RING_SLOTS
+  int count = island_elites(arena->cost, start, end, best, config.migration_size);
+  int num_targets = migration_targets(&tr->topo, tr->rank, epoch, targets);
+  int t, k;
+  for(k = 0; k < count; k++){
+    size_t len = migrant_encode(buf, chromosome(arena->cur, best[k]), arena->cost[best[k]], tr->rank, epoch);
+    for(t = 0; t < num_targets; t++){
+      tr->send(tr->self, targets[t], buf, len);
+    }
+  }
+}
+
+// True when genes visit every city exactly once, starting at city 0
+template<typename Gene>
+bool migrant_tour_valid(const Gene *genes, uint64_t *used){
+  int j;
+  if(genes[0] != 0) return false;
+  memset(used, 0, used_words()*sizeof(uint64_t));
+  for(j = 0; j < num_cities; j++){
+    int city = genes[j];
+    if(city >= num_cities || city_used(used, city)) return false;
+    mark_used(used, city);
+  }
+  return true;
+}
+
+// Take in every migrant waiting for this rank; each one replaces the
+// worst member of [start, end) if it is cheaper. Returns how many were
+// accepted.
+template<typename Gene, typename Dist>
+int process_immigrate(Transport *tr, PopArena<Gene> *arena, const Dist &dist, int start, int end, void *buf){
+  int accepted = 0;
+  size_t len;
+  MigrantHeader header;
+  while((len = tr->recv(tr->self, buf, tr->max_message)) > 0){
+    if(migrant_check<Gene>(buf, len, &header) == NULL) continue;
+    const Gene *genes = (const Gene *)((char *) buf + sizeof(MigrantHeader));
+    if(!migrant_tour_valid(genes, tr->used)) continue;
+    float cost = path_length(dist, genes);
+    int worst = island_worst(arena->cost, start, end);
+    if(cost < arena->cost[worst]){
+      memcpy(chromosome(arena->cur, worst), genes, num_cities*sizeof(Gene));
+      arena->cost[worst] = cost;
+      arena->cost_valid[worst] = 1;
+      accepted++;
+    }
+  }
+  return accepted;
+}
@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#pragma once
+
+// Loader for TSPLIB .tsp instances.
+// The file is mapped read-only and parsed in place: keywords are matched
+// against the mapping and numbers are converted straight from it, so
+// nothing is copied except the final coordinates or weights.
+
+enum EdgeWeightType { EUC_2D, CEIL_2D, GEO, ATT, EXPLICIT };
+enum EdgeWeightFormat { FULL_MATRIX, UPPER_ROW, LOWER_DIAG_ROW, UPPER_DIAG_ROW, NO_FORMAT };
+
+typedef struct TSPInstance {
+  char name[64];
+  int dimension;             // Number of cities
+  EdgeWeightType type;
+  EdgeWeightFormat format;   // Only meaningful for EXPLICIT instances
+  float *x;                  // Node coordinates (NULL for EXPLICIT)
+  float *y;
+  float *weights;            // dimension*dimension matrix (EXPLICIT only)
+} TSPInstance;
+
+// Cursor over the mapped file
+typedef struct {
+  const char *p;
+  const char *end;
+} TSPCursor;
+
+static void tsp_skip_space(TSPCursor *c){
+  while(c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\r' || *c->p == '\n')){
+    c->p++;
+  }
+}
+
+static void tsp_skip_line(TSPCursor *c){
+  while(c->p < c->end && *c->p != '\n'){
+    c->p++;
+  }
+  if(c->p < c->end){
+    c->p++;
+  }
+}
+
+// Length of the token under the cursor; a ':' ends a token
+static int tsp_token_len(TSPCursor *c){
+  const char *q = c->p;
+  while(q < c->end && *q != ' ' && *q != '\t' && *q != '\r' && *q != '\n' && *q != ':'){
+    q++;
+  }
+  return (int)(q - c->p);
+}
+
+static bool tsp_token_is(TSPCursor *c, int len, const char *word){
+  return len == (int)strlen(word) && strncmp(c->p, word, len) == 0;
+}
+
+// Move past the ':' of a "KEY : value" line and return the value's length
+static int tsp_value(TSPCursor *c){
+  while(c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == ':')){
+    c->p++;
+  }
+  const char *q = c->p;
+  while(q < c->end && *q != '\r' && *q != '\n'){
+    q++;
+  }
+  // Trim trailing blanks
+  while(q > c->p && (q[-1] == ' ' || q[-1] == '\t')){
+    q--;
+  }
+  return (int)(q - c->p);
+}
+
+// Parse one decimal number (optional sign, fraction and exponent)
+static bool tsp_number(TSPCursor *c, double *out){
+  tsp_skip_space(c);
+  const char *p = c->p;
+  const char *end = c->end;
+  double sign = 1.0, value = 0.0;
+  bool digits = false;
+  if(p < end && (*p == '-' || *p == '+')){
+    if(*p == '-') sign = -1.0;
+    p++;
+  }
+  while(p < end && *p >= '0' && *p <= '9'){
+    value = value*10.0 + (*p - '0');
+    p++;
+    digits = true;
+  }
+  if(p < end && *p == '.'){
+    double scale = 0.1;
+    p++;
+    while(p < end && *p >= '0' && *p <= '9'){
+      value += (*p - '0')*scale;
+      scale *= 0.1;
+      p++;
+      digits = true;
+    }
+  }
+  if(!digits){
+    return false;
+  }
+  if(p < end && (*p == 'e' || *p == 'E')){
+    int exp_sign = 1, exponent = 0;
+    p++;
+    if(p < end && (*p == '-' || *p == '+')){
+      if(*p == '-') exp_sign = -1;
+      p++;
+    }
+    while(p < end && *p >= '0' && *p <= '9'){
+      exponent = exponent*10 + (*p - '0');
+      p++;
+    }
+    value *= pow(10.0, exp_sign*exponent);
+  }
+  c->p = p;
+  *out = sign*value;
+  return true;
+}
+
+// Read the DIMENSION lines of a NODE_COORD_SECTION. Every node 1..DIMENSION
+// must appear once: with no ID repeated, DIMENSION lines cover them all, and
+// a short section runs into the next keyword, which is not a number.
+// Returns NULL, or what is wrong with the section.
+static const char* tsp_parse_nodes(TSPCursor *c, TSPInstance *inst){
+  int i;
+  double id, x, y;
+  uint8_t *seen = (uint8_t *) calloc(inst->dimension, 1);
+  if(seen == NULL) return "out of memory for NODE_COORD_SECTION";
+  const char *error = NULL;
+  for(i = 0; i < inst->dimension; i++){
+    if(!tsp_number(c, &id) || !tsp_number(c, &x) || !tsp_number(c, &y)){
+      error = "NODE_COORD_SECTION is short of DIMENSION nodes or has a bad number";
+      break;
+    }
+    // TSPLIB nodes are numbered from 1
+    if(!(id >= 1 && id <= inst->dimension) || id != floor(id)){
+      error = "node ID outside 1..DIMENSION in NODE_COORD_SECTION";
+      break;
+    }
+    int k = (int)id - 1;
+    if(seen[k]){
+      error = "node ID repeated in NODE_COORD_SECTION";
+      break;
+    }
+    seen[k] = 1;
+    inst->x[k] = (float)x;
+    inst->y[k] = (float)y;
+  }
+  free(seen);
+  return error;
+}
+
+static bool tsp_parse_weights(TSPCursor *c, TSPInstance *inst){
+  int n = inst->dimension;
+  int i, j;
+  double w;
+  for(i = 0; i < n; i++){
+    int first, last; // Columns stored for row i
+    switch(inst->format){
+      case FULL_MATRIX:    first = 0;     last = n - 1; break;
+      case UPPER_ROW:      first = i + 1; last = n - 1; break;
+      case UPPER_DIAG_ROW: first = i;     last = n - 1; break;
+      case LOWER_DIAG_ROW: first = 0;     last = i;     break;
+      default: return false;
+    }
+    for(j = first; j <= last; j++){
+      if(!tsp_number(c, &w)){
+        return false;
+      }
+      inst->weights[(size_t)i*n + j] = (float)w;
+      if(inst->format != FULL_MATRIX){
+        inst->weights[(size_t)j*n + i] = (float)w;
+      }
+    }
+  }
+  return true;
+}
+
+void tsp_free(TSPInstance *inst){
+  free(inst->x);
+  free(inst->y);
+  free(inst->weights);
+  inst->x = inst->y = inst->weights = NULL;
+}
+
+// Load a TSPLIB file. Returns false (after printing why) if the file cannot
+// be read or uses a type/format that is not supported.
+bool load_tsplib(const char *path, TSPInstance *inst){
+  memset(inst, 0, sizeof(TSPInstance));
+  inst->format = NO_FORMAT;
+
+  int fd = open(path, O_RDONLY);
+  if(fd < 0){ perror(path); return false; }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size == 0){
+    fprintf(stderr, "%s: empty or unreadable file\n", path);
+    close(fd);
+    return false;
+  }
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED){ perror(path); return false; }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  TSPCursor c;
+  c.p = (const char *) map;
+  c.end = c.p + st.st_size;
+  bool ok = true, have_type = false;
+  const char *error = NULL;
+
+  while(ok && c.p < c.end){
+    tsp_skip_space(&c);
+    if(c.p >= c.end){
+      break;
+    }
+    int len = tsp_token_len(&c);
+    if(tsp_token_is(&c, len, "EOF")){
+      break;
+    }
+    if(tsp_token_is(&c, len, "NAME")){
+      c.p += len;
+      len = tsp_value(&c);
+      if(len > 63) len = 63;
+      memcpy(inst->name, c.p, len);
+      inst->name[len] = '\0';
+      tsp_skip_line(&c);
+    }else if(tsp_token_is(&c, len, "DIMENSION")){
+      c.p += len;
+      tsp_value(&c);
+      double dim;
+      if(!tsp_number(&c, &dim) || dim < 2){ error = "bad DIMENSION"; ok = false; }
+      inst->dimension = (int)dim;
+      tsp_skip_line(&c);
+    }else if(tsp_token_is(&c, len, "EDGE_WEIGHT_TYPE")){
+      c.p += len;
+      len = tsp_value(&c);
+      have_type = true;
+      if(tsp_token_is(&c, len, "EUC_2D")) inst->type = EUC_2D;
+      else if(tsp_token_is(&c, len, "CEIL_2D")) inst->type = CEIL_2D;
+      else if(tsp_token_is(&c, len, "GEO")) inst->type = GEO;
+      else if(tsp_token_is(&c, len, "ATT")) inst->type = ATT;
+      else if(tsp_token_is(&c, len, "EXPLICIT")) inst->type = EXPLICIT;
+      else { error = "unsupported EDGE_WEIGHT_TYPE"; ok = false; }
+      tsp_skip_line(&c);
+    }else if(tsp_token_is(&c, len, "EDGE_WEIGHT_FORMAT")){
+      c.p += len;
+      len = tsp_value(&c);
+      if(tsp_token_is(&c, len, "FULL_MATRIX")) inst->format = FULL_MATRIX;
+      else if(tsp_token_is(&c, len, "UPPER_ROW")) inst->format = UPPER_ROW;
+      else if(tsp_token_is(&c, len, "LOWER_DIAG_ROW")) inst->format = LOWER_DIAG_ROW;
+      else if(tsp_token_is(&c, len, "UPPER_DIAG_ROW")) inst->format = UPPER_DIAG_ROW;
+      else { error = "unsupported EDGE_WEIGHT_FORMAT"; ok = false; }
+      tsp_skip_line(&c);
+    }else if(tsp_token_is(&c, len, "NODE_COORD_SECTION")){
+      tsp_skip_line(&c);
+      if(inst->dimension == 0 || !have_type || inst->type == EXPLICIT){
+        error = "NODE_COORD_SECTION needs a DIMENSION and a coordinate EDGE_WEIGHT_TYPE first";
+        ok = false;
+        break;
+      }
+      if(inst->x != NULL){ error = "repeated NODE_COORD_SECTION"; ok = false; break; }
+      inst->x = (float *) calloc(inst->dimension, sizeof(float));
+      inst->y = (float *) calloc(inst->dimension, sizeof(float));
+      if(inst->x == NULL || inst->y == NULL){ error = "out of memory for NODE_COORD_SECTION"; ok = false; break; }
+      error = tsp_parse_nodes(&c, inst);
+      if(error != NULL) ok = false;
+    }else if(tsp_token_is(&c, len, "EDGE_WEIGHT_SECTION")){
+      tsp_skip_line(&c);
+      if(inst->dimension == 0 || inst->format == NO_FORMAT){
+        error = "EDGE_WEIGHT_SECTION needs a DIMENSION and EDGE_WEIGHT_FORMAT first";
+        ok = false;
+        break;
+      }
+      if(inst->weights != NULL){ error = "repeated EDGE_WEIGHT_SECTION"; ok = false; break; }
+      inst->weights = (float *) calloc((size_t)inst->dimension*inst->dimension, sizeof(float));
+      if(inst->weights == NULL){ error = "out of memory for EDGE_WEIGHT_SECTION"; ok = false; break; }
+      if(!tsp_parse_weights(&c, inst)){ error = "bad EDGE_WEIGHT_SECTION"; ok = false; }
+    }else{
+      // COMMENT, TYPE, DISPLAY_DATA_TYPE, DISPLAY_DATA_SECTION data, ...
+      tsp_skip_line(&c);
+    }
+  }
+  munmap(map, st.st_size);
+
+  if(ok && !have_type){ error = "missing EDGE_WEIGHT_TYPE"; ok = false; }
+  if(ok && inst->type == EXPLICIT && inst->weights == NULL){ error = "missing EDGE_WEIGHT_SECTION"; ok = false; }
+  if(ok && inst->type != EXPLICIT && inst->x == NULL){ error = "missing NODE_COORD_SECTION"; ok = false; }
+  if(!ok){
+    fprintf(stderr, "%s: %s\n", path, error);
+    tsp_free(inst);
+    return false;
+  }
+  return true;
+}
+
+// TSPLIB "nearest integer"
+static inline float tsp_nint(double d){
+  return (float)(int)(d + 0.5);
+}
+
+// Latitude/longitude in radians from TSPLIB's DDD.MM notation
+static inline double tsp_geo_rad(float coord){
+  const double PI = 3.141592;
+  int deg = (int)coord;
+  double min = coord - deg;
+  return PI * (deg + 5.0 * min / 3.0) / 180.0;
+}
+
+// Distance between cities i and j as defined for the instance's edge weight type
+float tsp_distance(const TSPInstance *inst, int i, int j){
+  if(inst->type == EXPLICIT){
+    return inst->weights[(size_t)i*inst->dimension + j];
+  }
+  double dx = inst->x[i] - inst->x[j];
+  double dy = inst->y[i] - inst->y[j];
+  switch(inst->type){
+    case EUC_2D:
+      return tsp_nint(sqrt(dx*dx + dy*dy));
+    case CEIL_2D:
+      return (float)ceil(sqrt(dx*dx + dy*dy));
+    case ATT: {
+      double r = sqrt((dx*dx + dy*dy) / 10.0);
+      float t = tsp_nint(r);
+      return (t < r) ? t + 1.0f : t;
+    }
+    case GEO: {
+      const double RRR = 6378.388;
+      double lat_i = tsp_geo_rad(inst->x[i]), lon_i = tsp_geo_rad(inst->y[i]);
+      double lat_j = tsp_geo_rad(inst->x[j]), lon_j = tsp_geo_rad(inst->y[j]);
+      double q1 = cos(lon_i - lon_j);
+      double q2 = cos(lat_i - lat_j);
+      double q3 = cos(lat_i + lat_j);
+      return (float)(int)(RRR * acos(0.5*((1.0+q1)*q2 - (1.0-q1)*q3)) + 1.0);
+    }
+    default:
+      return 0.0f;
+  }
+}
+
+// Write tour, a permutation of the dimension cities numbered from 0, to
+// path as a TSPLIB .tour file (cities numbered from 1). Returns false
+// (after printing why) if the file can't be written.
+template<typename Gene>
+bool write_tsplib_tour(const char *path, const char *name, const Gene *tour, int dimension, float length){
+  FILE *out = fopen(path, "w");
+  if(out == NULL){ perror(path); return false; }
+  int i;
+  fprintf(out, "NAME : %s.tour\n", name);
+  fprintf(out, "COMMENT : Path length %.0f without the edge back to the first city\n", length);
+  fprintf(out, "TYPE : TOUR\n");
+  fprintf(out, "DIMENSION : %d\n", dimension);
+  fprintf(out, "TOUR_SECTION\n");
+  for(i = 0; i < dimension; i++){
+    fprintf(out, "%d\n", (int)tour[i] + 1);
+  }
+  fprintf(out, "-1\nEOF\n");
+  bool ok = (fclose(out) == 0);
+  if(!ok) perror(path);
+  return ok;
+}